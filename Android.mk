@@ -16,15 +16,41 @@
 
 LOCAL_PATH := $(call my-dir)
 
+# Daemon sources shared by wifid and the benchmark
+WIFID_CORE_SRC_FILES := \
+    src/WifiMessageHandler.cpp \
+    src/WifiMessageDecoder.cpp \
+    src/WifiBufferPool.cpp \
+    src/WifiCommandCache.cpp \
+    src/WifiCommandFlights.cpp \
+    src/WifiEventFilter.cpp \
+    src/WifiEventCoalescer.cpp \
+    src/WifiDriverState.cpp \
+    src/WifiBringUp.cpp \
+    src/WifiRequestTable.cpp \
+    src/WifiResponseStream.cpp \
+    src/WifiScanResults.cpp \
+    src/WifiScheduler.cpp \
+    src/WifiStats.cpp \
+    src/WifiWorkerPool.cpp \
+    src/WifiHal.cpp \
+    src/WifiLogger.cpp \
+    src/WifiSupplicantCtrl.cpp \
+    src/WifiSupplicantMonitor.cpp \
+    src/IpcHandler.cpp \
+    src/WifiIpcHandler.cpp \
+    src/WifiShmIpcHandler.cpp \
+    src/WifiIpcConnection.cpp \
+    src/WifiIpcLifecycle.cpp \
+    src/WifiIpcManager.cpp
+
 # Build wifid
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     src/wifid.cpp \
-    src/WifiMessageHandler.cpp \
-    src/IpcHandler.cpp \
-    src/WifiIpcHandler.cpp \
-    src/WifiIpcManager.cpp
+    src/WifiLegacyHal.cpp \
+    $(WIFID_CORE_SRC_FILES)
 
 LOCAL_C_INCLUDES += \
     $(LOCAL_PATH)/src \
@@ -44,6 +70,83 @@ LOCAL_SHARED_LIBRARIES += \
 LOCAL_MODULE := wifid
 LOCAL_MODULE_TAGS := optional
 
-LOCAL_CFLAGS := -DDEBUG -DPLATFORM_ANDROID -DSTDC_HEADERS=1 -DHAVE_SYS_TYPES_H=1 -DHAVE_SYS_STAT_H=1 -DHAVE_STDLIB_H=1 -DHAVE_STRING_H=1 -DHAVE_MEMORY_H=1 -DHAVE_STRINGS_H=1 -DHAVE_INTTYPES_H=1 -DHAVE_STDINT_H=1 -DHAVE_UNISTD_H=1 -DHAVE_DLFCN_H=1 -DSILENT=1 -DNO_SIGNALS=1 -DNO_EXECUTE_PERMISSION=1 -D_GNU_SOURCE -D_REENTRANT -DUSE_MMAP -DUSE_MUNMAP -D_FILE_OFFSET_BITS=64 -DNO_UNALIGNED_ACCESS
+# Lowest log priority built in, 3 debug, 5 warning or 6 error. Messages
+# below it are compiled out. Override with WIFID_LOG_LEVEL=<n> on the
+# command line.
+ifeq ($(TARGET_BUILD_VARIANT),eng)
+WIFID_LOG_LEVEL ?= 3
+else
+WIFID_LOG_LEVEL ?= 5
+endif
+
+LOCAL_CFLAGS := -DWIFID_LOG_LEVEL=$(WIFID_LOG_LEVEL) -DPLATFORM_ANDROID -DSTDC_HEADERS=1 -DHAVE_SYS_TYPES_H=1 -DHAVE_SYS_STAT_H=1 -DHAVE_STDLIB_H=1 -DHAVE_STRING_H=1 -DHAVE_MEMORY_H=1 -DHAVE_STRINGS_H=1 -DHAVE_INTTYPES_H=1 -DHAVE_STDINT_H=1 -DHAVE_UNISTD_H=1 -DHAVE_DLFCN_H=1 -DSILENT=1 -DNO_SIGNALS=1 -DNO_EXECUTE_PERMISSION=1 -D_GNU_SOURCE -D_REENTRANT -DUSE_MMAP -DUSE_MUNMAP -D_FILE_OFFSET_BITS=64 -DNO_UNALIGNED_ACCESS
+
+include $(BUILD_EXECUTABLE)
+
+# Build the fake supplicant used to test wifid on a Linux host
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    tools/FakeSupplicant.cpp \
+    tools/fake_supplicant.cpp
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/tools
+
+LOCAL_LDLIBS := -lpthread
+
+LOCAL_MODULE := wifid_fake_supplicant
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Build the benchmark to run against wifid on a device
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    tools/wifid_bench.cpp \
+    tools/WifiBench.cpp \
+    tools/FakeHal.cpp \
+    tools/FakeSupplicant.cpp \
+    $(WIFID_CORE_SRC_FILES)
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/src \
+    $(LOCAL_PATH)/tools \
+    external/stlport/stlport
+
+LOCAL_SHARED_LIBRARIES += \
+    libutils \
+    liblog
+
+LOCAL_CFLAGS := -DWIFID_LOG_LEVEL=5 -D_GNU_SOURCE
+
+LOCAL_MODULE := wifid_bench
+LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_EXECUTABLE)
+
+# Build the benchmark for a Linux host, run it with -i to serve the
+# requests from wifid in process on a fake HAL and supplicant
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    tools/wifid_bench.cpp \
+    tools/WifiBench.cpp \
+    tools/FakeHal.cpp \
+    tools/FakeSupplicant.cpp \
+    $(WIFID_CORE_SRC_FILES)
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/src \
+    $(LOCAL_PATH)/tools
+
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_CFLAGS := -DWIFID_LOG_LEVEL=5 -D_GNU_SOURCE
+
+LOCAL_MODULE := wifid_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -18,6 +18,7 @@
 #define IpcHandler_h
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 class IpcHandler {
 public:
@@ -25,14 +26,39 @@ public:
 
   virtual int readIpc(uint8_t* aData, size_t aDataLen) = 0;
 
+  // The size of the packet the next readIpc() returns, which must get a
+  // buffer at least that large. 0 on stream transports or if none is
+  // waiting.
+  virtual size_t getNextPacketSize() = 0;
+
+  // Returns the number of bytes written. A socket never waits for room
+  // and fails with EAGAIN if it takes nothing, shared memory waits for
+  // room in its ring.
   virtual int writeIpc(uint8_t* aData, size_t aDataLen) = 0;
 
+  // Gathers the buffers into one message on the wire without blocking.
+  // Returns the number of bytes written, 0 if the peer is not ready.
+  virtual int writevIpc(const struct iovec* aIov, int aIovCnt) = 0;
+
+  // Writes as many of the frames, one buffer each, as the peer accepts
+  // without blocking. Packet sockets never split a frame. Returns the
+  // number of bytes written, 0 if the peer is not ready.
+  virtual int writeFramesIpc(const struct iovec* aFrames, int aCount) = 0;
+
   virtual int closeIpc() = 0;
 
   virtual int waitForData() = 0;
 
   virtual bool isConnected() = 0;
 
+  // A listening handler hands out one new handler per accepted peer.
+  virtual bool isListening() = 0;
+
+  virtual IpcHandler* acceptIpc() = 0;
+
+  // The descriptor to poll for incoming data or peers.
+  virtual int getFd() = 0;
+
   virtual ~IpcHandler() = 0;
 };
 
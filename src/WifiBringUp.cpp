@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "WifiBringUp.h"
+#include "WifiDebug.h"
+#include "WifiMessageHandler.h"
+#include "WifiStats.h"
+
+/**
+ * Starts or stops the supplicant on a worker thread.
+ */
+class WifiSupplicantTask
+  : public WifiTask
+{
+public:
+  WifiSupplicantTask(WifiHal* aHal, WifiBringUp* aBringUp, bool aStart,
+                     bool aP2pSupported)
+    : mHal(aHal)
+    , mBringUp(aBringUp)
+    , mStart(aStart)
+    , mP2pSupported(aP2pSupported)
+    , mResult(-1)
+  {
+  }
+
+  void run()
+  {
+    mResult = mStart ? mHal->startSupplicant(mP2pSupported) :
+                       mHal->stopSupplicant(mP2pSupported);
+  }
+
+  void complete()
+  {
+    mBringUp->onSupplicantDone(mResult);
+  }
+
+private:
+  WifiHal* mHal;
+  WifiBringUp* mBringUp;
+  bool mStart;
+  bool mP2pSupported;
+  int mResult;
+};
+
+WifiBringUp::WifiBringUp(WifiMessageHandler* aMsgHandler,
+  WifiDriverState* aDriver)
+  : mMsgHandler(aMsgHandler)
+  , mDriver(aDriver)
+  , mIpcMgr(NULL)
+  , mHal(NULL)
+  , mWorkerPool(NULL)
+  , mId(WIFI_REQUEST_ID_INVALID)
+  , mType(WIFI_MESSAGE_TYPE_BRING_UP)
+  , mP2pSupported(false)
+  , mSupplicantDone(false)
+  , mConnected(false)
+  , mStartTime(0)
+  , mSupplicantDoneTime(0)
+{
+  assert(aMsgHandler);
+  assert(aDriver);
+}
+
+void
+WifiBringUp::setIpcManager(WifiIpcManager* aIpcMgr)
+{
+  assert(aIpcMgr);
+
+  mIpcMgr = aIpcMgr;
+}
+
+void
+WifiBringUp::setHal(WifiHal* aHal, WifiWorkerPool* aWorkerPool)
+{
+  assert(aHal);
+  assert(aWorkerPool);
+
+  mHal = aHal;
+  mWorkerPool = aWorkerPool;
+}
+
+void
+WifiBringUp::bringUp(WifiRequestId aId, bool aP2pSupported)
+{
+  if (!begin(aId, WIFI_MESSAGE_TYPE_BRING_UP, aP2pSupported)) {
+    return;
+  }
+
+  // The supplicant needs the driver, everything else waits for it.
+  startStage(WIFI_STAGE_DRIVER);
+  mDriver->load(this);
+}
+
+void
+WifiBringUp::tearDown(WifiRequestId aId, bool aP2pSupported)
+{
+  if (!begin(aId, WIFI_MESSAGE_TYPE_TEAR_DOWN, aP2pSupported)) {
+    return;
+  }
+
+  startStage(WIFI_STAGE_CONNECTION);
+  mMsgHandler->closeSupplicantConnection();
+  endStage(WIFI_STAGE_CONNECTION);
+
+  startSupplicant();
+}
+
+void
+WifiBringUp::onDriverLoaded(int aResult)
+{
+  endStage(WIFI_STAGE_DRIVER);
+
+  if (aResult < 0) {
+    finish(WIFI_STAGE_DRIVER);
+    return;
+  }
+
+  startSupplicant();
+
+  // Connect as soon as the supplicant opens its socket.
+  startStage(WIFI_STAGE_CONNECTION);
+  tryConnect();
+}
+
+void
+WifiBringUp::onDriverUnloaded(int aResult)
+{
+  endStage(WIFI_STAGE_DRIVER);
+
+  finish(aResult < 0 ? WIFI_STAGE_DRIVER : WIFI_STAGE_NONE);
+}
+
+void
+WifiBringUp::onSupplicantDone(int aResult)
+{
+  endStage(WIFI_STAGE_SUPPLICANT);
+  mSupplicantDone = true;
+  mSupplicantDoneTime = WifiStats::getTime();
+
+  if (aResult < 0) {
+    mIpcMgr->cancelTimer(this);
+    finish(WIFI_STAGE_SUPPLICANT);
+    return;
+  }
+
+  if (mType == WIFI_MESSAGE_TYPE_TEAR_DOWN) {
+    startStage(WIFI_STAGE_DRIVER);
+    mDriver->unload(this);
+    return;
+  }
+
+  if (mConnected) {
+    finish(WIFI_STAGE_NONE);
+  }
+}
+
+void
+WifiBringUp::onTimer()
+{
+  tryConnect();
+}
+
+bool
+WifiBringUp::begin(WifiRequestId aId, WifiMessageType aType,
+  bool aP2pSupported)
+{
+  if (!mHal || !mWorkerPool) {
+    WIFID_ERROR("No HAL to run the request Type(%d).", aType);
+    mMsgHandler->processResponse(aId, aType, WIFI_STATUS_ERROR, NULL, 0);
+    return false;
+  }
+
+  if (mId != WIFI_REQUEST_ID_INVALID) {
+    WIFID_WARNING("Request Type(%d) while another one is running.", aType);
+    mMsgHandler->processResponse(aId, aType, WIFI_STATUS_ERROR, NULL, 0);
+    return false;
+  }
+
+  mId = aId;
+  mType = aType;
+  mP2pSupported = aP2pSupported;
+  mSupplicantDone = false;
+  mConnected = false;
+  mStartTime = WifiStats::getTime();
+  memset(mStageStart, 0, sizeof(mStageStart));
+  memset(mStageTime, 0, sizeof(mStageTime));
+
+  return true;
+}
+
+void
+WifiBringUp::startStage(WifiStage aStage)
+{
+  mStageStart[aStage] = WifiStats::getTime();
+}
+
+void
+WifiBringUp::endStage(WifiStage aStage)
+{
+  mStageTime[aStage] = WifiStats::getTime() - mStageStart[aStage];
+}
+
+void
+WifiBringUp::startSupplicant()
+{
+  startStage(WIFI_STAGE_SUPPLICANT);
+
+  // Blocking HAL calls must not hold up the loop.
+  mWorkerPool->submit(new WifiSupplicantTask(mHal, this,
+    mType == WIFI_MESSAGE_TYPE_BRING_UP, mP2pSupported));
+}
+
+void
+WifiBringUp::tryConnect()
+{
+  if (mMsgHandler->isSupplicantReady() &&
+      mMsgHandler->connectToSupplicant() == 0) {
+    endStage(WIFI_STAGE_CONNECTION);
+    mConnected = true;
+    if (mSupplicantDone) {
+      finish(WIFI_STAGE_NONE);
+    }
+    return;
+  }
+
+  if (mSupplicantDone &&
+      WifiStats::getTime() - mSupplicantDoneTime > CONNECT_TIMEOUT_US) {
+    endStage(WIFI_STAGE_CONNECTION);
+    finish(WIFI_STAGE_CONNECTION);
+    return;
+  }
+
+  mIpcMgr->setTimer(this, CONNECT_RETRY_US);
+}
+
+void
+WifiBringUp::finish(uint16_t aFailedStage)
+{
+  struct WifiMsgStageTimes times;
+  WifiRequestId id = mId;
+
+  times.failedStage = aFailedStage;
+  times.numStages = WIFI_STAGE_COUNT;
+  times.totalTime = WifiStats::getTime() - mStartTime;
+  memcpy(times.stageTime, mStageTime, sizeof(times.stageTime));
+
+  WIFID_DEBUG("Request Type(%d) done in %uus: driver %uus, supplicant %uus, "
+    "connection %uus, failed stage %u.", mType, times.totalTime,
+    mStageTime[WIFI_STAGE_DRIVER], mStageTime[WIFI_STAGE_SUPPLICANT],
+    mStageTime[WIFI_STAGE_CONNECTION], aFailedStage);
+
+  // Idle before answering, the client may send the next one right away.
+  mId = WIFI_REQUEST_ID_INVALID;
+
+  mMsgHandler->processResponse(id, mType,
+    aFailedStage == WIFI_STAGE_NONE ? WIFI_STATUS_OK : WIFI_STATUS_ERROR,
+    &times, sizeof(times));
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiBringUp_h
+#define WifiBringUp_h
+
+#include <stdint.h>
+
+#include "WifiDriverState.h"
+#include "WifiGonkMessage.h"
+#include "WifiHal.h"
+#include "WifiIpcManager.h"
+#include "WifiRequestTable.h"
+#include "WifiWorkerPool.h"
+
+class WifiMessageHandler;
+
+/**
+ * Runs WIFI_MESSAGE_TYPE_BRING_UP and WIFI_MESSAGE_TYPE_TEAR_DOWN as one
+ * pipeline inside the daemon, without a round trip to the client between
+ * the stages.
+ *
+ * Bringing up, the connection to the supplicant is retried every
+ * CONNECT_RETRY_US from the moment the supplicant is being started rather
+ * than once its start returned, so the connection usually overlaps the
+ * tail of the start. The driver goes through WifiDriverState and costs
+ * nothing if it was kept loaded. Tearing down, the unload is deferred by
+ * WifiDriverState the same way.
+ *
+ * One pipeline runs at a time. Only used from the thread running
+ * WifiIpcManager::loop().
+ */
+class WifiBringUp
+  : public WifiDriverListener
+  , public WifiTimerListener
+{
+public:
+  static const uint64_t CONNECT_RETRY_US = 10000;
+  // How long the supplicant may take to open its socket once started.
+  static const uint64_t CONNECT_TIMEOUT_US = 2000000;
+
+  WifiBringUp(WifiMessageHandler* aMsgHandler, WifiDriverState* aDriver);
+
+  void setIpcManager(WifiIpcManager* aIpcMgr);
+  void setHal(WifiHal* aHal, WifiWorkerPool* aWorkerPool);
+
+  // Answer the request aId through WifiMessageHandler::processResponse().
+  void bringUp(WifiRequestId aId, bool aP2pSupported);
+  void tearDown(WifiRequestId aId, bool aP2pSupported);
+
+  void onDriverLoaded(int aResult);
+  void onDriverUnloaded(int aResult);
+  // Called back on the loop thread once the supplicant started or stopped.
+  void onSupplicantDone(int aResult);
+  // Retries the connection.
+  void onTimer();
+
+private:
+  bool begin(WifiRequestId aId, WifiMessageType aType, bool aP2pSupported);
+  void startStage(WifiStage aStage);
+  void endStage(WifiStage aStage);
+  void startSupplicant();
+  void tryConnect();
+  void finish(uint16_t aFailedStage);
+
+  WifiMessageHandler* mMsgHandler;
+  WifiDriverState* mDriver;
+  WifiIpcManager* mIpcMgr;
+  WifiHal* mHal;
+  WifiWorkerPool* mWorkerPool;
+
+  WifiRequestId mId;              // WIFI_REQUEST_ID_INVALID when idle
+  WifiMessageType mType;
+  bool mP2pSupported;
+  bool mSupplicantDone;
+  bool mConnected;
+  uint64_t mStartTime;
+  uint64_t mSupplicantDoneTime;
+  uint64_t mStageStart[WIFI_STAGE_COUNT];
+  uint32_t mStageTime[WIFI_STAGE_COUNT];
+};
+
+#endif // WifiBringUp_h
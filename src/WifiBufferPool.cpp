@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "WifiBufferPool.h"
+
+// Every buffer is preceded by its size class, kept 8-byte aligned.
+#define POOL_PREFIX_SIZE 8
+#define POOL_UNPOOLED NUM_CLASSES
+
+static const size_t sClassSize[WifiBufferPool::NUM_CLASSES] = {
+  64, 256, 1024, 4096
+};
+
+WifiBufferPool* WifiBufferPool::sInstance = NULL;
+
+WifiBufferPool*
+WifiBufferPool::Instance()
+{
+  if (!sInstance) {
+    sInstance = new WifiBufferPool();
+  }
+  return sInstance;
+}
+
+WifiBufferPool::WifiBufferPool()
+{
+  memset(mFreeList, 0, sizeof(mFreeList));
+  memset(mFreeCount, 0, sizeof(mFreeCount));
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+WifiBufferPool::~WifiBufferPool()
+{
+  for (size_t i = 0; i < NUM_CLASSES; i++) {
+    while (mFreeList[i]) {
+      FreeBuffer* buf = mFreeList[i];
+      mFreeList[i] = buf->next;
+      free(reinterpret_cast<uint8_t*>(buf) - POOL_PREFIX_SIZE);
+    }
+  }
+}
+
+size_t
+WifiBufferPool::getClass(size_t aSize)
+{
+  for (size_t i = 0; i < NUM_CLASSES; i++) {
+    if (aSize <= sClassSize[i]) {
+      return i;
+    }
+  }
+  return POOL_UNPOOLED;
+}
+
+uint8_t*
+WifiBufferPool::alloc(size_t aSize)
+{
+  size_t cls = getClass(aSize);
+  uint8_t* raw;
+
+  mStats.inUse++;
+
+  if (cls != POOL_UNPOOLED && mFreeList[cls]) {
+    FreeBuffer* buf = mFreeList[cls];
+    mFreeList[cls] = buf->next;
+    mFreeCount[cls]--;
+    mStats.hits++;
+    return reinterpret_cast<uint8_t*>(buf);
+  }
+
+  mStats.misses++;
+
+  raw = static_cast<uint8_t*>(
+    malloc(POOL_PREFIX_SIZE + (cls != POOL_UNPOOLED ? sClassSize[cls] : aSize)));
+  if (!raw) {
+    mStats.inUse--;
+    return NULL;
+  }
+
+  raw[0] = static_cast<uint8_t>(cls);
+
+  return raw + POOL_PREFIX_SIZE;
+}
+
+void
+WifiBufferPool::release(uint8_t* aBuf)
+{
+  size_t cls;
+
+  if (!aBuf) {
+    return;
+  }
+
+  cls = aBuf[-POOL_PREFIX_SIZE];
+
+  assert(cls <= POOL_UNPOOLED);
+
+  mStats.releases++;
+  mStats.inUse--;
+
+  if (cls == POOL_UNPOOLED || mFreeCount[cls] >= MAX_FREE_PER_CLASS) {
+    free(aBuf - POOL_PREFIX_SIZE);
+    return;
+  }
+
+  FreeBuffer* buf = reinterpret_cast<FreeBuffer*>(aBuf);
+  buf->next = mFreeList[cls];
+  mFreeList[cls] = buf;
+  mFreeCount[cls]++;
+}
+
+void
+WifiBufferPool::getStats(struct WifiBufferPoolStats* aStats)
+{
+  assert(aStats);
+
+  *aStats = mStats;
+}
+
+void
+WifiBufferPool::report(std::string* aOut)
+{
+  char line[128];
+
+  snprintf(line, sizeof(line), "buffer_pool hits %u misses %u releases %u "
+    "in_use %u\n", mStats.hits, mStats.misses, mStats.releases, mStats.inUse);
+  aOut->append(line);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiBufferPool_h
+#define WifiBufferPool_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+struct WifiBufferPoolStats {
+  uint32_t hits;      // served from a free list
+  uint32_t misses;    // served by malloc
+  uint32_t releases;
+  uint32_t inUse;
+};
+
+/**
+ * Size-classed pool of message buffers. Released buffers are kept on a
+ * free list per class, so steady-state traffic reuses them without
+ * calling malloc. Buffers larger than the biggest class are not pooled.
+ *
+ * The pool is only used from the thread running WifiIpcManager::loop().
+ */
+class WifiBufferPool
+{
+private:
+  static WifiBufferPool* sInstance;
+
+public:
+  static const size_t NUM_CLASSES = 4;
+  static const size_t MAX_FREE_PER_CLASS = 32;
+
+  ~WifiBufferPool();
+
+  static WifiBufferPool* Instance();
+
+  uint8_t* alloc(size_t aSize);
+  void release(uint8_t* aBuf);
+
+  void getStats(struct WifiBufferPoolStats* aStats);
+  void report(std::string* aOut);
+
+private:
+  WifiBufferPool();
+
+  struct FreeBuffer {
+    FreeBuffer* next;
+  };
+
+  static size_t getClass(size_t aSize);
+
+  FreeBuffer* mFreeList[NUM_CLASSES];
+  size_t mFreeCount[NUM_CLASSES];
+  struct WifiBufferPoolStats mStats;
+};
+
+#endif // WifiBufferPool_h
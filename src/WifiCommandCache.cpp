@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "WifiCommandCache.h"
+#include "WifiStats.h"
+
+#define IFNAME_PREFIX "IFNAME="
+
+#define KIND_BIT(kind) (1 << WifiCommandCache::KIND_##kind)
+#define ALL_KINDS ((1 << WifiCommandCache::NUM_KINDS) - 1)
+#define CONNECTION_KINDS \
+  (KIND_BIT(STATUS) | KIND_BIT(SIGNAL_POLL) | KIND_BIT(LIST_NETWORKS))
+#define NETWORK_KINDS (KIND_BIT(LIST_NETWORKS) | KIND_BIT(GET_NETWORK))
+
+struct WifiCommandRule {
+  const char* command;
+  bool hasArguments;
+  uint64_t ttl;               // microseconds
+};
+
+// In the order of Kind. SIGNAL_POLL changes all the time, the network
+// list only through commands and events.
+static const WifiCommandRule sRules[] = {
+  { "STATUS",        false, 1000000 },
+  { "SIGNAL_POLL",   false, 1000000 },
+  { "LIST_NETWORKS", false, 30000000 },
+  { "GET_NETWORK",   true,  30000000 },
+};
+
+// Commands that change nothing but are not worth caching.
+static const char* sQueries[] = {
+  "PING", "SCAN", "SCAN_RESULTS", "BSS", "MIB", "GET", "GET_CAPABILITY",
+  "INTERFACES", "STATUS-VERBOSE",
+};
+
+struct WifiEventRule {
+  const char* event;
+  uint32_t kinds;
+};
+
+// Most supplicant events come with a state change, which is enough for
+// STATUS and SIGNAL_POLL. The list shows the current and disabled networks.
+static const WifiEventRule sEventRules[] = {
+  { "CTRL-EVENT-STATE-CHANGE",       CONNECTION_KINDS },
+  { "CTRL-EVENT-CONNECTED",          CONNECTION_KINDS },
+  { "CTRL-EVENT-DISCONNECTED",       CONNECTION_KINDS },
+  { "CTRL-EVENT-SCAN-RESULTS",       KIND_BIT(STATUS) },
+  { "CTRL-EVENT-SIGNAL-CHANGE",      KIND_BIT(SIGNAL_POLL) },
+  { "CTRL-EVENT-SSID-TEMP-DISABLED", KIND_BIT(LIST_NETWORKS) },
+  { "CTRL-EVENT-SSID-REENABLED",     KIND_BIT(LIST_NETWORKS) },
+  { "CTRL-EVENT-NETWORK-ADDED",      NETWORK_KINDS },
+  { "CTRL-EVENT-NETWORK-REMOVED",    NETWORK_KINDS },
+  { "CTRL-EVENT-TERMINATING",        ALL_KINDS },
+};
+
+static size_t
+trimCommand(const char* aCmd, size_t aLen)
+{
+  // Clients may send the terminating NUL or a newline along.
+  while (aLen > 0 && (aCmd[aLen - 1] == '\0' || aCmd[aLen - 1] == '\n')) {
+    aLen--;
+  }
+
+  return aLen;
+}
+
+// Whether aCmd is aName, alone or followed by arguments.
+static bool
+matchCommand(const char* aCmd, size_t aLen, const char* aName, bool aArguments)
+{
+  size_t nameLen = strlen(aName);
+
+  if (aLen < nameLen || strncmp(aCmd, aName, nameLen)) {
+    return false;
+  }
+
+  return aLen == nameLen || (aArguments && aCmd[nameLen] == ' ');
+}
+
+WifiCommandCache::WifiCommandCache()
+{
+  memset(mGenerations, 0, sizeof(mGenerations));
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+bool
+WifiCommandCache::isQuery(const char* aCmd, size_t aLen)
+{
+  return classify(aCmd, trimCommand(aCmd, aLen)) != KIND_OTHER;
+}
+
+WifiCommandCache::Kind
+WifiCommandCache::classify(const char* aCmd, size_t aLen)
+{
+  const char* space;
+
+  if (aLen > strlen(IFNAME_PREFIX) &&
+      !strncmp(aCmd, IFNAME_PREFIX, strlen(IFNAME_PREFIX))) {
+    space = static_cast<const char*>(memchr(aCmd, ' ', aLen));
+    if (!space) {
+      return KIND_OTHER;
+    }
+    aLen -= space + 1 - aCmd;
+    aCmd = space + 1;
+  }
+
+  for (int i = 0; i < NUM_KINDS; i++) {
+    if (matchCommand(aCmd, aLen, sRules[i].command, sRules[i].hasArguments)) {
+      return static_cast<Kind>(i);
+    }
+  }
+
+  for (size_t i = 0; i < sizeof(sQueries) / sizeof(sQueries[0]); i++) {
+    if (matchCommand(aCmd, aLen, sQueries[i], true)) {
+      return KIND_QUERY;
+    }
+  }
+
+  return KIND_OTHER;
+}
+
+const std::string*
+WifiCommandCache::lookup(WifiRequestId aId, const char* aCmd, size_t aLen)
+{
+  std::map<std::string, Entry>::iterator it;
+  Kind kind;
+
+  aLen = trimCommand(aCmd, aLen);
+  kind = classify(aCmd, aLen);
+
+  if (kind == KIND_OTHER) {
+    // May change the configuration the cached replies show.
+    invalidate(ALL_KINDS);
+    return NULL;
+  }
+
+  if (kind == KIND_QUERY) {
+    return NULL;
+  }
+
+  std::string command(aCmd, aLen);
+
+  it = mEntries.find(command);
+  if (it != mEntries.end()) {
+    if (WifiStats::getTime() < it->second.expiry) {
+      mStats.hits++;
+      return &it->second.reply;
+    }
+    mStats.expirations++;
+    mEntries.erase(it);
+  }
+
+  mStats.misses++;
+
+  PendingFill& pending = mPending[aId];
+  pending.command.swap(command);
+  pending.generation = mGenerations[kind];
+  pending.kind = kind;
+
+  return NULL;
+}
+
+void
+WifiCommandCache::fill(WifiRequestId aId, bool aSuccess, const char* aReply,
+  size_t aLen)
+{
+  std::map<WifiRequestId, PendingFill>::iterator it = mPending.find(aId);
+  std::map<std::string, Entry>::iterator entry;
+
+  if (it == mPending.end()) {
+    return;
+  }
+
+  const PendingFill& pending = it->second;
+
+  // Failures are not worth remembering.
+  if (aSuccess && aLen > 0 && strncmp(aReply, "FAIL", aLen < 4 ? aLen : 4) &&
+      pending.generation == mGenerations[pending.kind]) {
+    if (mEntries.size() >= MAX_ENTRIES) {
+      uint64_t now = WifiStats::getTime();
+
+      for (entry = mEntries.begin(); entry != mEntries.end(); ) {
+        if (entry->second.expiry <= now) {
+          mEntries.erase(entry++);
+        } else {
+          ++entry;
+        }
+      }
+    }
+
+    if (mEntries.size() < MAX_ENTRIES) {
+      Entry& e = mEntries[pending.command];
+      e.reply.assign(aReply, aLen);
+      e.expiry = WifiStats::getTime() + sRules[pending.kind].ttl;
+      e.kind = pending.kind;
+      mStats.fills++;
+    }
+  }
+
+  mPending.erase(it);
+}
+
+void
+WifiCommandCache::cancelFill(WifiRequestId aId)
+{
+  mPending.erase(aId);
+}
+
+bool
+WifiCommandCache::onEvent(const char* aEvent, size_t aLen)
+{
+  for (size_t i = 0; i < sizeof(sEventRules) / sizeof(sEventRules[0]); i++) {
+    size_t len = strlen(sEventRules[i].event);
+
+    if (aLen >= len && !strncmp(aEvent, sEventRules[i].event, len)) {
+      invalidate(sEventRules[i].kinds);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+WifiCommandCache::invalidateAll()
+{
+  invalidate(ALL_KINDS);
+}
+
+void
+WifiCommandCache::invalidate(uint32_t aKinds)
+{
+  std::map<std::string, Entry>::iterator it;
+
+  // Replies of commands sent before now are stale.
+  for (int i = 0; i < NUM_KINDS; i++) {
+    if (aKinds & (1 << i)) {
+      mGenerations[i]++;
+    }
+  }
+
+  for (it = mEntries.begin(); it != mEntries.end(); ) {
+    if (aKinds & (1 << it->second.kind)) {
+      mEntries.erase(it++);
+      mStats.invalidations++;
+    } else {
+      ++it;
+    }
+  }
+}
+
+void
+WifiCommandCache::getStats(struct WifiCommandCacheStats* aStats)
+{
+  *aStats = mStats;
+}
+
+void
+WifiCommandCache::report(std::string* aOut)
+{
+  char line[160];
+
+  snprintf(line, sizeof(line), "command_cache entries %zu hits %u misses %u "
+    "fills %u expired %u invalidated %u\n", mEntries.size(), mStats.hits,
+    mStats.misses, mStats.fills, mStats.expirations, mStats.invalidations);
+  aOut->append(line);
+}
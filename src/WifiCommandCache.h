@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiCommandCache_h
+#define WifiCommandCache_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+
+#include "WifiRequestTable.h"
+
+struct WifiCommandCacheStats {
+  uint32_t hits;            // answered from the cache
+  uint32_t misses;          // cacheable, forwarded to the supplicant
+  uint32_t fills;
+  uint32_t expirations;     // entries found past their TTL
+  uint32_t invalidations;   // entries dropped by events or commands
+};
+
+/**
+ * Cache of the replies of the supplicant queries clients poll most:
+ * STATUS, SIGNAL_POLL, LIST_NETWORKS and GET_NETWORK, keyed by the
+ * command text.
+ *
+ * Each kind of query has its own TTL and is dropped by the events that
+ * change its answer. Any command that is not a known query may change the
+ * configuration, it drops every entry. Replies of commands sent before an
+ * invalidation are not stored.
+ *
+ * Only used from the thread running WifiIpcManager::loop().
+ */
+class WifiCommandCache
+{
+public:
+  // Kinds of cached queries, then the other commands.
+  enum Kind {
+    KIND_STATUS,
+    KIND_SIGNAL_POLL,
+    KIND_LIST_NETWORKS,
+    KIND_GET_NETWORK,
+    NUM_KINDS,
+    KIND_QUERY = NUM_KINDS,   // read only, not cached
+    KIND_OTHER
+  };
+
+  static const size_t MAX_ENTRIES = 64;
+
+  WifiCommandCache();
+
+  // Whether aCmd only reads the state of the supplicant.
+  static bool isQuery(const char* aCmd, size_t aLen);
+
+  // Returns the cached reply of aCmd, or NULL. On a miss of a cacheable
+  // command the reply of the request aId will fill the cache.
+  const std::string* lookup(WifiRequestId aId, const char* aCmd, size_t aLen);
+
+  // Stores the reply of the request aId if lookup() expects it.
+  void fill(WifiRequestId aId, bool aSuccess, const char* aReply, size_t aLen);
+
+  // Forgets the request aId, whose command was not sent.
+  void cancelFill(WifiRequestId aId);
+
+  // Drops the entries a supplicant event makes stale. Returns true if the
+  // event changes the answer of some query.
+  bool onEvent(const char* aEvent, size_t aLen);
+
+  // Drops everything, when the supplicant goes away.
+  void invalidateAll();
+
+  void getStats(struct WifiCommandCacheStats* aStats);
+  void report(std::string* aOut);
+
+private:
+  struct Entry {
+    std::string reply;
+    uint64_t expiry;          // monotonic microseconds
+    Kind kind;
+  };
+
+  struct PendingFill {
+    std::string command;
+    uint32_t generation;
+    Kind kind;
+  };
+
+  static Kind classify(const char* aCmd, size_t aLen);
+
+  void invalidate(uint32_t aKinds);
+
+  std::map<std::string, Entry> mEntries;
+  std::map<WifiRequestId, PendingFill> mPending;
+  // Bumped by every invalidation of a kind.
+  uint32_t mGenerations[NUM_KINDS];
+
+  struct WifiCommandCacheStats mStats;
+};
+
+#endif // WifiCommandCache_h
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include "WifiCommandFlights.h"
+
+WifiCommandFlights::WifiCommandFlights()
+  : mSent(0)
+  , mMerged(0)
+{
+}
+
+bool
+WifiCommandFlights::join(WifiRequestId aId, const char* aCmd, size_t aLen)
+{
+  std::string command(aCmd, aLen);
+  std::map<std::string, WifiRequestId>::iterator it = mLeaders.find(command);
+
+  if (it != mLeaders.end()) {
+    mFlights[it->second].followers.push_back(aId);
+    mMerged++;
+    return true;
+  }
+
+  mLeaders[command] = aId;
+  mFlights[aId].command.swap(command);
+  mSent++;
+
+  return false;
+}
+
+void
+WifiCommandFlights::land(WifiRequestId aId,
+  std::vector<WifiRequestId>* aFollowers)
+{
+  std::map<WifiRequestId, Flight>::iterator it = mFlights.find(aId);
+  std::map<std::string, WifiRequestId>::iterator leader;
+
+  if (it == mFlights.end()) {
+    return;
+  }
+
+  aFollowers->insert(aFollowers->end(), it->second.followers.begin(),
+    it->second.followers.end());
+
+  // A closed flight may have been followed by a new one.
+  leader = mLeaders.find(it->second.command);
+  if (leader != mLeaders.end() && leader->second == aId) {
+    mLeaders.erase(leader);
+  }
+  mFlights.erase(it);
+}
+
+void
+WifiCommandFlights::closeAll()
+{
+  mLeaders.clear();
+}
+
+void
+WifiCommandFlights::report(std::string* aOut)
+{
+  char line[128];
+
+  snprintf(line, sizeof(line), "command_flights inflight %zu sent %u merged %u\n",
+    mFlights.size(), mSent, mMerged);
+  aOut->append(line);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiCommandFlights_h
+#define WifiCommandFlights_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "WifiRequestTable.h"
+
+/**
+ * Merges identical queries sent to the supplicant while one is already on
+ * its way. The first request of a command text leads the flight and is
+ * the only one sent, the later ones wait for its reply. Once a command or
+ * an event may have changed the answer, the flights on their way take no
+ * more followers.
+ *
+ * Only used from the thread running WifiIpcManager::loop().
+ */
+class WifiCommandFlights
+{
+public:
+  WifiCommandFlights();
+
+  // Returns true if aId joined the flight of an identical command,
+  // otherwise aId leads a new flight and its command must be sent.
+  bool join(WifiRequestId aId, const char* aCmd, size_t aLen);
+
+  // Ends the flight led by aId, if any, and appends the requests waiting
+  // for its reply to aFollowers.
+  void land(WifiRequestId aId, std::vector<WifiRequestId>* aFollowers);
+
+  // Closes the flights on their way to new followers.
+  void closeAll();
+
+  void report(std::string* aOut);
+
+private:
+  struct Flight {
+    std::string command;
+    std::vector<WifiRequestId> followers;
+  };
+
+  // By id of the leading request.
+  std::map<WifiRequestId, Flight> mFlights;
+  std::map<std::string, WifiRequestId> mLeaders;
+
+  uint32_t mSent;
+  uint32_t mMerged;
+};
+
+#endif // WifiCommandFlights_h
@@ -18,6 +18,7 @@
 #define WifiDebug_h
 
 #include "utils/Log.h"
+#include "WifiLogger.h"
 
 extern bool gWifiDebugFlag;
 
@@ -25,16 +26,53 @@ extern bool gWifiDebugFlag;
 
 #define TAG_WIFID "wifid"
 
+// Same values as the android log priorities, usable in #if.
+#define WIFID_LOG_LEVEL_DEBUG 3
+#define WIFID_LOG_LEVEL_WARNING 5
+#define WIFID_LOG_LEVEL_ERROR 6
+
+// Messages below this level are compiled out, set from Android.mk.
+#ifndef WIFID_LOG_LEVEL
+#define WIFID_LOG_LEVEL WIFID_LOG_LEVEL_WARNING
+#endif
+
 #define WIFI_DEBUG(level, tag, msg, ...)                                 \
-  if (gWifiDebugFlag) {                                                  \
-    __android_log_print(level, tag, "%s: " msg, FUNC, ##__VA_ARGS__);    \
-  }
+  do {                                                                   \
+    if (gWifiDebugFlag) {                                                \
+      WifiLogger::Instance()->log(level, tag, FUNC, msg, ##__VA_ARGS__); \
+    }                                                                    \
+  } while (0)
 
+// Still type checks the arguments, but generates no code.
+#define WIFI_NO_DEBUG(level, tag, msg, ...)                              \
+  do {                                                                   \
+    if (0) {                                                             \
+      WifiLogger::Instance()->log(level, tag, FUNC, msg, ##__VA_ARGS__); \
+    }                                                                    \
+  } while (0)
+
+#if WIFID_LOG_LEVEL <= WIFID_LOG_LEVEL_DEBUG
 #define WIFID_DEBUG(msg, ...)  \
   WIFI_DEBUG(ANDROID_LOG_DEBUG, TAG_WIFID, msg, ##__VA_ARGS__)
+#else
+#define WIFID_DEBUG(msg, ...)  \
+  WIFI_NO_DEBUG(ANDROID_LOG_DEBUG, TAG_WIFID, msg, ##__VA_ARGS__)
+#endif
+
+#if WIFID_LOG_LEVEL <= WIFID_LOG_LEVEL_WARNING
 #define WIFID_WARNING(msg, ...)  \
   WIFI_DEBUG(ANDROID_LOG_WARN, TAG_WIFID, msg, ##__VA_ARGS__)
+#else
+#define WIFID_WARNING(msg, ...)  \
+  WIFI_NO_DEBUG(ANDROID_LOG_WARN, TAG_WIFID, msg, ##__VA_ARGS__)
+#endif
+
+#if WIFID_LOG_LEVEL <= WIFID_LOG_LEVEL_ERROR
 #define WIFID_ERROR(msg, ...)  \
   WIFI_DEBUG(ANDROID_LOG_ERROR, TAG_WIFID, msg, ##__VA_ARGS__)
+#else
+#define WIFID_ERROR(msg, ...)  \
+  WIFI_NO_DEBUG(ANDROID_LOG_ERROR, TAG_WIFID, msg, ##__VA_ARGS__)
+#endif
 
 #endif
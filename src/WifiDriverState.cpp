@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "WifiDebug.h"
+#include "WifiDriverState.h"
+#include "WifiMessageHandler.h"
+#include "WifiStats.h"
+
+/**
+ * Loads or unloads the driver on a worker thread.
+ */
+class WifiDriverTask
+  : public WifiTask
+{
+public:
+  WifiDriverTask(WifiHal* aHal, WifiDriverState* aState, bool aLoad)
+    : mHal(aHal)
+    , mState(aState)
+    , mLoad(aLoad)
+    , mResult(-1)
+    , mDuration(0)
+  {
+  }
+
+  void run()
+  {
+    uint64_t start = WifiStats::getTime();
+
+    mResult = mLoad ? mHal->loadDriver() : mHal->unloadDriver();
+    mDuration = WifiStats::getTime() - start;
+  }
+
+  void complete()
+  {
+    if (mLoad) {
+      mState->onLoaded(mResult, mDuration);
+    } else {
+      mState->onUnloaded(mResult, mDuration);
+    }
+  }
+
+private:
+  WifiHal* mHal;
+  WifiDriverState* mState;
+  bool mLoad;
+  int mResult;
+  uint64_t mDuration;
+};
+
+WifiDriverState::WifiDriverState(WifiMessageHandler* aMsgHandler)
+  : mMsgHandler(aMsgHandler)
+  , mIpcMgr(NULL)
+  , mHal(NULL)
+  , mWorkerPool(NULL)
+  , mUnloadDelay(DEFAULT_UNLOAD_DELAY_US)
+  , mState(UNLOADED)
+{
+  assert(aMsgHandler);
+
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+void
+WifiDriverState::setIpcManager(WifiIpcManager* aIpcMgr)
+{
+  assert(aIpcMgr);
+
+  mIpcMgr = aIpcMgr;
+}
+
+void
+WifiDriverState::setHal(WifiHal* aHal, WifiWorkerPool* aWorkerPool)
+{
+  assert(aHal);
+  assert(aWorkerPool);
+
+  mHal = aHal;
+  mWorkerPool = aWorkerPool;
+}
+
+void
+WifiDriverState::setUnloadDelay(uint64_t aDelayUs)
+{
+  mUnloadDelay = aDelayUs;
+}
+
+void
+WifiDriverState::load(WifiRequestId aId)
+{
+  load(makeWaiter(aId, NULL));
+}
+
+void
+WifiDriverState::unload(WifiRequestId aId)
+{
+  unload(makeWaiter(aId, NULL));
+}
+
+void
+WifiDriverState::load(WifiDriverListener* aListener)
+{
+  assert(aListener);
+
+  load(makeWaiter(WIFI_REQUEST_ID_INVALID, aListener));
+}
+
+void
+WifiDriverState::unload(WifiDriverListener* aListener)
+{
+  assert(aListener);
+
+  unload(makeWaiter(WIFI_REQUEST_ID_INVALID, aListener));
+}
+
+void
+WifiDriverState::load(const Waiter& aWaiter)
+{
+  if (!mHal || !mWorkerPool) {
+    WIFID_ERROR("No HAL to load the driver.");
+    answer(aWaiter, WIFI_MESSAGE_TYPE_LOAD_DRIVER, -1);
+    return;
+  }
+
+  switch (mState) {
+    case UNLOAD_PENDING:
+      // Turned back on within the delay, the driver never went away.
+      mIpcMgr->cancelTimer(this);
+      mState = LOADED;
+      mStats.keptLoaded++;
+      // Fall through.
+    case LOADED:
+      answer(aWaiter, WIFI_MESSAGE_TYPE_LOAD_DRIVER, 0);
+      break;
+
+    case LOADING:
+      mStats.merged++;
+      mLoadWaiters.push_back(aWaiter);
+      break;
+
+    case UNLOADING:
+      // Loaded again once the unload is over.
+      mLoadWaiters.push_back(aWaiter);
+      break;
+
+    case UNLOADED:
+      mLoadWaiters.push_back(aWaiter);
+      startLoad();
+      break;
+  }
+}
+
+void
+WifiDriverState::unload(const Waiter& aWaiter)
+{
+  if (!mHal || !mWorkerPool) {
+    WIFID_ERROR("No HAL to unload the driver.");
+    answer(aWaiter, WIFI_MESSAGE_TYPE_UNLOAD_DRIVER, -1);
+    return;
+  }
+
+  switch (mState) {
+    case LOADED:
+      if (mUnloadDelay == 0) {
+        mUnloadWaiters.push_back(aWaiter);
+        startUnload();
+        break;
+      }
+      mState = UNLOAD_PENDING;
+      mIpcMgr->setTimer(this, mUnloadDelay);
+      // Fall through.
+    case UNLOAD_PENDING:
+      answer(aWaiter, WIFI_MESSAGE_TYPE_UNLOAD_DRIVER, 0);
+      break;
+
+    case LOADING:
+      // Handled once the load is over.
+      mUnloadWaiters.push_back(aWaiter);
+      break;
+
+    case UNLOADING:
+      mStats.merged++;
+      mUnloadWaiters.push_back(aWaiter);
+      break;
+
+    case UNLOADED:
+      // The driver may have been left loaded by a previous instance.
+      mUnloadWaiters.push_back(aWaiter);
+      startUnload();
+      break;
+  }
+}
+
+void
+WifiDriverState::onLoaded(int aResult, uint64_t aDuration)
+{
+  std::vector<Waiter> unloads;
+
+  assert(mState == LOADING);
+
+  mStats.loads++;
+  mStats.lastLoadTime = aDuration;
+  if (aDuration > mStats.maxLoadTime) {
+    mStats.maxLoadTime = aDuration;
+  }
+
+  mState = aResult < 0 ? UNLOADED : LOADED;
+  answerAll(&mLoadWaiters, WIFI_MESSAGE_TYPE_LOAD_DRIVER, aResult);
+
+  WIFID_DEBUG("Driver loaded in %" PRIu64 "us, result %d.", aDuration, aResult);
+
+  // Unloads that came in meanwhile start over from the new state.
+  unloads.swap(mUnloadWaiters);
+  for (size_t i = 0; i < unloads.size(); i++) {
+    unload(unloads[i]);
+  }
+}
+
+void
+WifiDriverState::onUnloaded(int aResult, uint64_t aDuration)
+{
+  std::vector<Waiter> loads;
+
+  assert(mState == UNLOADING);
+
+  mStats.unloads++;
+  mStats.lastUnloadTime = aDuration;
+  if (aDuration > mStats.maxUnloadTime) {
+    mStats.maxUnloadTime = aDuration;
+  }
+
+  mState = aResult < 0 ? LOADED : UNLOADED;
+  answerAll(&mUnloadWaiters, WIFI_MESSAGE_TYPE_UNLOAD_DRIVER, aResult);
+
+  WIFID_DEBUG("Driver unloaded in %" PRIu64 "us, result %d.", aDuration, aResult);
+
+  loads.swap(mLoadWaiters);
+  for (size_t i = 0; i < loads.size(); i++) {
+    load(loads[i]);
+  }
+}
+
+void
+WifiDriverState::onTimer()
+{
+  if (mState == UNLOAD_PENDING) {
+    startUnload();
+  }
+}
+
+void
+WifiDriverState::getStats(struct WifiDriverStats* aStats)
+{
+  *aStats = mStats;
+}
+
+void
+WifiDriverState::report(std::string* aOut)
+{
+  static const char* sStateNames[] = {
+    "unloaded", "loading", "loaded", "unload_pending", "unloading"
+  };
+  char line[256];
+
+  snprintf(line, sizeof(line), "driver %s loads %u unloads %u kept_loaded %u "
+    "merged %u load %" PRIu64 "us max %" PRIu64 "us unload %" PRIu64 "us max %"
+    PRIu64 "us\n", sStateNames[mState], mStats.loads, mStats.unloads,
+    mStats.keptLoaded, mStats.merged, mStats.lastLoadTime, mStats.maxLoadTime,
+    mStats.lastUnloadTime, mStats.maxUnloadTime);
+  aOut->append(line);
+}
+
+void
+WifiDriverState::startLoad()
+{
+  mState = LOADING;
+
+  // Blocking HAL calls must not hold up the loop.
+  mWorkerPool->submit(new WifiDriverTask(mHal, this, true));
+}
+
+void
+WifiDriverState::startUnload()
+{
+  mState = UNLOADING;
+
+  mWorkerPool->submit(new WifiDriverTask(mHal, this, false));
+}
+
+WifiDriverState::Waiter
+WifiDriverState::makeWaiter(WifiRequestId aId, WifiDriverListener* aListener)
+{
+  Waiter waiter;
+
+  waiter.id = aId;
+  waiter.listener = aListener;
+
+  return waiter;
+}
+
+void
+WifiDriverState::answer(const Waiter& aWaiter, WifiMessageType aType,
+  int aResult)
+{
+  if (aWaiter.listener) {
+    if (aType == WIFI_MESSAGE_TYPE_LOAD_DRIVER) {
+      aWaiter.listener->onDriverLoaded(aResult);
+    } else {
+      aWaiter.listener->onDriverUnloaded(aResult);
+    }
+    return;
+  }
+
+  mMsgHandler->processResponse(aWaiter.id, aType,
+    aResult < 0 ? WIFI_STATUS_ERROR : WIFI_STATUS_OK, NULL, 0);
+}
+
+void
+WifiDriverState::answerAll(std::vector<Waiter>* aWaiters,
+  WifiMessageType aType, int aResult)
+{
+  std::vector<Waiter> waiters;
+
+  waiters.swap(*aWaiters);
+
+  for (size_t i = 0; i < waiters.size(); i++) {
+    answer(waiters[i], aType, aResult);
+  }
+}
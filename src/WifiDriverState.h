@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiDriverState_h
+#define WifiDriverState_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "WifiGonkMessage.h"
+#include "WifiHal.h"
+#include "WifiIpcManager.h"
+#include "WifiRequestTable.h"
+#include "WifiWorkerPool.h"
+
+class WifiMessageHandler;
+
+/**
+ * Told when a driver operation asked for by the daemon itself is over.
+ */
+class WifiDriverListener
+{
+public:
+  virtual void onDriverLoaded(int aResult) = 0;
+  virtual void onDriverUnloaded(int aResult) = 0;
+
+  virtual ~WifiDriverListener() {}
+};
+
+struct WifiDriverStats {
+  uint32_t loads;             // driver loads run by the HAL
+  uint32_t unloads;           // driver unloads run by the HAL
+  uint32_t keptLoaded;        // loads answered from a deferred unload
+  uint32_t merged;            // requests answered by an operation in flight
+  uint64_t lastLoadTime;      // microseconds
+  uint64_t maxLoadTime;
+  uint64_t lastUnloadTime;
+  uint64_t maxUnloadTime;
+};
+
+/**
+ * Loads and unloads the driver on behalf of the requests, with
+ * hysteresis.
+ *
+ * An unload is answered at once but only run once the driver stayed
+ * unused for the unload delay, so a load arriving meanwhile is answered
+ * at once too and turning WiFi off and on costs no firmware download.
+ * Requests arriving while the driver is being loaded or unloaded wait for
+ * that operation instead of starting another one. A delay of 0 unloads
+ * right away and answers once done.
+ *
+ * Only used from the thread running WifiIpcManager::loop().
+ */
+class WifiDriverState
+  : public WifiTimerListener
+{
+public:
+  static const uint64_t DEFAULT_UNLOAD_DELAY_US = 10000000;
+
+  WifiDriverState(WifiMessageHandler* aMsgHandler);
+
+  void setIpcManager(WifiIpcManager* aIpcMgr);
+  void setHal(WifiHal* aHal, WifiWorkerPool* aWorkerPool);
+  void setUnloadDelay(uint64_t aDelayUs);
+
+  // Answer the request aId through WifiMessageHandler::processResponse().
+  void load(WifiRequestId aId);
+  void unload(WifiRequestId aId);
+  // Same for the daemon itself, aListener is called back instead.
+  void load(WifiDriverListener* aListener);
+  void unload(WifiDriverListener* aListener);
+
+  // Called back on the loop thread by the HAL operations.
+  void onLoaded(int aResult, uint64_t aDuration);
+  void onUnloaded(int aResult, uint64_t aDuration);
+
+  // Runs the deferred unload.
+  void onTimer();
+
+  void getStats(struct WifiDriverStats* aStats);
+
+  // Appends a one line text report.
+  void report(std::string* aOut);
+
+private:
+  enum State {
+    UNLOADED,
+    LOADING,
+    LOADED,
+    UNLOAD_PENDING,           // loaded, unload deferred
+    UNLOADING
+  };
+
+  // A request, or a listener if id is WIFI_REQUEST_ID_INVALID.
+  struct Waiter {
+    WifiRequestId id;
+    WifiDriverListener* listener;
+  };
+
+  static Waiter makeWaiter(WifiRequestId aId, WifiDriverListener* aListener);
+
+  void load(const Waiter& aWaiter);
+  void unload(const Waiter& aWaiter);
+  void startLoad();
+  void startUnload();
+  void answer(const Waiter& aWaiter, WifiMessageType aType, int aResult);
+  void answerAll(std::vector<Waiter>* aWaiters, WifiMessageType aType,
+                 int aResult);
+
+  WifiMessageHandler* mMsgHandler;
+  WifiIpcManager* mIpcMgr;
+  WifiHal* mHal;
+  WifiWorkerPool* mWorkerPool;
+  uint64_t mUnloadDelay;
+  State mState;
+  std::vector<Waiter> mLoadWaiters;
+  std::vector<Waiter> mUnloadWaiters;
+  struct WifiDriverStats mStats;
+};
+
+#endif // WifiDriverState_h
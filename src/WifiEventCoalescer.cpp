@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "WifiEventCoalescer.h"
+#include "WifiGonkMessage.h"
+#include "WifiMessageHandler.h"
+
+#define IFNAME_PREFIX "IFNAME="
+
+struct WifiSupersedeRule {
+  const char* prefix;
+  bool perBss;            // keyed by the BSSID ending the event
+};
+
+static const WifiSupersedeRule sRules[] = {
+  { "CTRL-EVENT-SIGNAL-CHANGE", false },
+  { "CTRL-EVENT-SCAN-STARTED",  false },
+  { "CTRL-EVENT-BSS-ADDED",     true },
+  { "CTRL-EVENT-BSS-REMOVED",   true },
+};
+
+WifiEventCoalescer::WifiEventCoalescer(WifiMessageHandler* aMsgHandler)
+  : mMsgHandler(aMsgHandler)
+  , mIpcMgr(NULL)
+  , mWindow(0)
+  , mMaxEvents(DEFAULT_MAX_EVENTS)
+  , mLength(0)
+  , mTimerSet(false)
+{
+  assert(aMsgHandler);
+
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+void
+WifiEventCoalescer::setIpcManager(WifiIpcManager* aIpcMgr)
+{
+  assert(aIpcMgr);
+
+  mIpcMgr = aIpcMgr;
+}
+
+void
+WifiEventCoalescer::setWindow(uint64_t aWindowUs, size_t aMaxEvents)
+{
+  flush();
+
+  mWindow = aWindowUs;
+  mMaxEvents = aMaxEvents > 0 ? aMaxEvents : 1;
+}
+
+bool
+WifiEventCoalescer::getKey(const char* aEvent, size_t aLen, std::string* aKey)
+{
+  const char* event = aEvent;
+  const char* space;
+  size_t len = aLen;
+
+  // Events of other interfaces never replace each other.
+  if (len > strlen(IFNAME_PREFIX) &&
+      !strncmp(event, IFNAME_PREFIX, strlen(IFNAME_PREFIX))) {
+    space = static_cast<const char*>(memchr(event, ' ', len));
+    if (!space) {
+      return false;
+    }
+    len -= space + 1 - event;
+    event = space + 1;
+  }
+
+  for (size_t i = 0; i < sizeof(sRules) / sizeof(sRules[0]); i++) {
+    size_t prefixLen = strlen(sRules[i].prefix);
+
+    if (len < prefixLen || strncmp(event, sRules[i].prefix, prefixLen)) {
+      continue;
+    }
+
+    aKey->assign(aEvent, event - aEvent);
+
+    if (!sRules[i].perBss) {
+      aKey->append(sRules[i].prefix);
+      return true;
+    }
+
+    // "CTRL-EVENT-BSS-ADDED <id> <bssid>", added and removed share a key.
+    space = static_cast<const char*>(memrchr(event, ' ', len));
+    if (!space) {
+      return false;
+    }
+    aKey->append("BSS");
+    aKey->append(space, event + len - space);
+    return true;
+  }
+
+  return false;
+}
+
+void
+WifiEventCoalescer::add(const char* aEvents, size_t aLength)
+{
+  const char* end = aEvents + aLength;
+  const char* event;
+  size_t len;
+
+  if (mWindow == 0 || !mIpcMgr) {
+    mMsgHandler->sendNotificationEvent(const_cast<char*>(aEvents), aLength);
+    mStats.flushes++;
+    return;
+  }
+
+  for (event = aEvents; event < end; event += len + 1) {
+    Event pending;
+
+    len = strnlen(event, end - event);
+    mStats.events++;
+
+    pending.text.assign(event, len);
+
+    if (getKey(event, len, &pending.key)) {
+      for (size_t i = 0; i < mEvents.size(); i++) {
+        if (mEvents[i].key == pending.key) {
+          mLength -= mEvents[i].text.size() + 1;
+          mEvents.erase(mEvents.begin() + i);
+          mStats.superseded++;
+          break;
+        }
+      }
+    }
+
+    // Keep the batch in one frame.
+    if (mLength + len + 1 >
+        WIFI_MESSAGE_MAX_FRAME_SIZE - sizeof(struct WifiMsgNotify)) {
+      flush();
+    }
+
+    // The window starts with the first event of the batch, superseded
+    // or not.
+    if (!mTimerSet) {
+      mIpcMgr->setTimer(this, mWindow);
+      mTimerSet = true;
+    }
+
+    mEvents.push_back(pending);
+    mLength += len + 1;
+
+    if (mEvents.size() >= mMaxEvents) {
+      flush();
+    }
+  }
+}
+
+void
+WifiEventCoalescer::flush()
+{
+  std::string batch;
+
+  if (mTimerSet) {
+    mIpcMgr->cancelTimer(this);
+    mTimerSet = false;
+  }
+
+  if (mEvents.empty()) {
+    return;
+  }
+
+  batch.reserve(mLength);
+  for (size_t i = 0; i < mEvents.size(); i++) {
+    batch.append(mEvents[i].text);
+    batch.push_back('\0');
+  }
+
+  mEvents.clear();
+  mLength = 0;
+  mStats.flushes++;
+
+  mMsgHandler->sendNotificationEvent(&batch[0], batch.size());
+}
+
+void
+WifiEventCoalescer::onTimer()
+{
+  mTimerSet = false;
+  flush();
+}
+
+void
+WifiEventCoalescer::report(std::string* aOut)
+{
+  char line[160];
+
+  snprintf(line, sizeof(line), "events window %" PRIu64 "us received %u "
+    "superseded %u batches %u\n", mWindow, mStats.events, mStats.superseded,
+    mStats.flushes);
+  aOut->append(line);
+}
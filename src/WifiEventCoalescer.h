@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiEventCoalescer_h
+#define WifiEventCoalescer_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "WifiIpcManager.h"
+
+class WifiMessageHandler;
+
+struct WifiEventCoalescerStats {
+  uint32_t events;          // events received from the supplicant
+  uint32_t superseded;      // events replaced by a later one of their key
+  uint32_t flushes;         // batches handed to the connections
+};
+
+/**
+ * Holds the supplicant events back for a short window and sends them as
+ * one batch, so a storm of events costs one frame and one wakeup of the
+ * peers instead of one per read of the monitor.
+ *
+ * Events that only report the latest state of something, signal changes,
+ * scan starts and the BSS added or removed per BSSID, replace the one of
+ * the same key still waiting. Every other event is kept, in order.
+ *
+ * The batch is sent once the window since its first event is over, or
+ * right away once it holds the maximum number of events or a frame worth
+ * of them. A window of 0 sends every batch of the monitor as it comes.
+ *
+ * Only used from the thread running WifiIpcManager::loop().
+ */
+class WifiEventCoalescer
+  : public WifiTimerListener
+{
+public:
+  static const size_t DEFAULT_MAX_EVENTS = 64;
+
+  WifiEventCoalescer(WifiMessageHandler* aMsgHandler);
+
+  void setIpcManager(WifiIpcManager* aIpcMgr);
+  void setWindow(uint64_t aWindowUs, size_t aMaxEvents);
+
+  // Takes the NUL-terminated events of aEvents.
+  void add(const char* aEvents, size_t aLength);
+  void flush();
+
+  // Sends the batch once the window is over.
+  void onTimer();
+
+  void report(std::string* aOut);
+
+private:
+  struct Event {
+    std::string text;
+    std::string key;        // empty if never superseded
+  };
+
+  static bool getKey(const char* aEvent, size_t aLen, std::string* aKey);
+
+  WifiMessageHandler* mMsgHandler;
+  WifiIpcManager* mIpcMgr;
+  uint64_t mWindow;
+  size_t mMaxEvents;
+
+  std::vector<Event> mEvents;
+  size_t mLength;           // of the batch to send
+  bool mTimerSet;
+
+  struct WifiEventCoalescerStats mStats;
+};
+
+#endif // WifiEventCoalescer_h
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "WifiEventFilter.h"
+#include "WifiGonkMessage.h"
+
+#define IFNAME_PREFIX "IFNAME="
+
+struct WifiEventClassRule {
+  const char* prefix;
+  uint32_t eventClass;
+};
+
+// First match wins, so longer prefixes go before shorter ones.
+static const WifiEventClassRule sRules[] = {
+  { "CTRL-EVENT-SCAN-",             WIFI_EVENT_CLASS_SCAN },
+  { "CTRL-EVENT-BSS-",              WIFI_EVENT_CLASS_SCAN },
+  { "CTRL-EVENT-DRIVER-STATE",      WIFI_EVENT_CLASS_DRIVER },
+  { "CTRL-EVENT-TERMINATING",       WIFI_EVENT_CLASS_DRIVER },
+  { "CTRL-EVENT-REGDOM-CHANGE",     WIFI_EVENT_CLASS_DRIVER },
+  { "CTRL-EVENT-",                  WIFI_EVENT_CLASS_CONNECTION },
+  { "Trying to associate",          WIFI_EVENT_CLASS_CONNECTION },
+  { "Associated with",              WIFI_EVENT_CLASS_CONNECTION },
+  { "Authentication with",          WIFI_EVENT_CLASS_CONNECTION },
+  { "WPA:",                         WIFI_EVENT_CLASS_CONNECTION },
+  { "P2P-",                         WIFI_EVENT_CLASS_P2P },
+  { "AP-STA-",                      WIFI_EVENT_CLASS_P2P },
+  { "WPS-",                         WIFI_EVENT_CLASS_WPS },
+};
+
+uint32_t
+WifiEventFilter::classify(const char* aEvent, size_t aLen)
+{
+  const char* space;
+
+  // Events of a global control interface name their interface first.
+  if (aLen > strlen(IFNAME_PREFIX) &&
+      !strncmp(aEvent, IFNAME_PREFIX, strlen(IFNAME_PREFIX))) {
+    space = static_cast<const char*>(memchr(aEvent, ' ', aLen));
+    if (space) {
+      aLen -= space + 1 - aEvent;
+      aEvent = space + 1;
+    }
+  }
+
+  for (size_t i = 0; i < sizeof(sRules) / sizeof(sRules[0]); i++) {
+    size_t len = strlen(sRules[i].prefix);
+
+    if (aLen >= len && !strncmp(aEvent, sRules[i].prefix, len)) {
+      return sRules[i].eventClass;
+    }
+  }
+
+  return WIFI_EVENT_CLASS_OTHER;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiEventFilter_h
+#define WifiEventFilter_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Sorts the supplicant events into the WifiEventClass of
+ * WIFI_MESSAGE_TYPE_SUBSCRIBE.
+ */
+class WifiEventFilter
+{
+public:
+  // Returns the class of aEvent, without its "<level>" prefix.
+  static uint32_t classify(const char* aEvent, size_t aLen);
+};
+
+#endif // WifiEventFilter_h
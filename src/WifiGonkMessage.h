@@ -42,8 +42,80 @@ extern "C" {
  *
  * Payload of a notification message
  *   Data of the notification message.
+ *
+ * WIFI_MESSAGE_TYPE_COMMAND carries the wpa_supplicant command text as the
+ * request data and the supplicant's reply text as the response data.
+ *
+ * WIFI_MESSAGE_TYPE_STATS has no request data, the response data is a
+ * text report of the request counters and latencies of the daemon, one
+ * line per message type and per connection (since version 1.3).
+ *
+ * WIFI_MESSAGE_TYPE_BRING_UP loads the driver, starts the supplicant and
+ * connects the daemon to it, WIFI_MESSAGE_TYPE_TEAR_DOWN undoes the same in
+ * reverse order (since version 1.5). Both take a struct WifiMsgStartStopSupp
+ * and answer once every stage is over, or at the first failing one, with a
+ * struct WifiMsgStageTimes whatever the status. One of them runs at a time,
+ * a request arriving meanwhile fails without data.
+ *
+ * WIFI_MESSAGE_TYPE_BATCH carries complete request messages back to back as
+ * its request data (since version 1.6). Each of them is handled as if sent
+ * alone, and the response data of the batch is their complete response
+ * messages back to back, in the order they finished, once all did. The
+ * responses inside a batch are never chunked. A batch can not contain
+ * WIFI_MESSAGE_TYPE_BATCH or WIFI_MESSAGE_TYPE_SHM_TRANSPORT, which fail.
+ * A malformed batch fails as a whole, before any of its requests runs.
+ * So does a batch of more than WIFI_BATCH_MAX_REQUESTS requests, and one
+ * whose response data would exceed WIFI_BATCH_MAX_RESPONSE_SIZE bytes
+ * fails as soon as it does, without data.
+ *
+ * WIFI_MESSAGE_TYPE_SUBSCRIBE takes a struct WifiMsgSubscribe (since version
+ * 1.7). From then on only the events of the WifiEventClass set in its
+ * eventMask are sent to the connection, the others are dropped. A
+ * connection starts subscribed to WIFI_EVENT_CLASS_ALL.
+ *
+ * WIFI_NOTIFICATION_EVENT carries one or more supplicant events, each a
+ * NUL-terminated string, back to back (since version 1.1).
+ *
+ * Chunked messages (since version 1.2)
+ *   Responses and notifications whose data does not fit in one frame of
+ *   WIFI_MESSAGE_MAX_FRAME_SIZE bytes are sent as a series of frames.
+ *   Every frame but the last has WIFI_MESSAGE_FLAG_MORE set in its
+ *   message type and the data of the series is their concatenation.
+ *   Chunks of a response repeat its session Id, so frames of other
+ *   sessions may come in between. The chunks of a notification are never
+ *   interleaved with other notifications. A series ending with an error status
+ *   was aborted and its data must be dropped.
+ *
+ * Shared memory transport (since version 1.4)
+ *   WIFI_MESSAGE_TYPE_SHM_TRANSPORT has no request data. On success the
+ *   response carries a struct WifiMsgShmTransport and, as SCM_RIGHTS, the
+ *   memfd of the shared region, the eventfd waking the client and the
+ *   eventfd waking the daemon, in that order. Every later message in both
+ *   directions goes through the rings of the region instead of the
+ *   socket, which is then only watched for hang-up. An error status means
+ *   the daemon can not share memory and the socket stays in use.
+ *
+ *   The region holds the WifiShmRing of the requests at offset 0, the one
+ *   of the responses and notifications at WIFI_SHM_RING_HEADER_SIZE, then
+ *   the data of both rings, ringSize bytes each, from WIFI_SHM_DATA_OFFSET
+ *   on. A ring is a byte stream of messages: head and tail are free
+ *   running byte counts, bytes [tail, head) modulo ringSize are readable.
+ *   A side that finds its ring empty sets readerWaiting, or writerWaiting
+ *   if it is full, and sleeps on its eventfd. The other side only writes
+ *   the eventfd when it sees the flag, after clearing it. Both rings
+ *   start with readerWaiting set.
  */
 
+#define WIFI_MESSAGE_MAX_FRAME_SIZE 4096
+#define WIFI_MESSAGE_FLAG_MORE 0x8000
+#define WIFI_MESSAGE_TYPE_MASK 0x7fff
+
+#define WIFI_BATCH_MAX_REQUESTS 64
+#define WIFI_BATCH_MAX_RESPONSE_SIZE (64 * 1024)
+
+#define WIFI_SHM_RING_HEADER_SIZE 192
+#define WIFI_SHM_DATA_OFFSET 4096
+
 /**
  * Message categories.
  */
@@ -65,6 +137,12 @@ typedef enum {
   WIFI_MESSAGE_TYPE_CONNECT_TO_SUPPLICANT,
   WIFI_MESSAGE_TYPE_CLOSE_SUPPLICANT_CONNECTION,
   WIFI_MESSAGE_TYPE_COMMAND,
+  WIFI_MESSAGE_TYPE_STATS,
+  WIFI_MESSAGE_TYPE_SHM_TRANSPORT,
+  WIFI_MESSAGE_TYPE_BRING_UP,
+  WIFI_MESSAGE_TYPE_TEAR_DOWN,
+  WIFI_MESSAGE_TYPE_BATCH,
+  WIFI_MESSAGE_TYPE_SUBSCRIBE,
 } WifiMessageType;
 
 /**
@@ -75,6 +153,32 @@ typedef enum {
   WIFI_STATUS_ERROR = 1
 } WifiStatusCode;
 
+/**
+ * Stages of WIFI_MESSAGE_TYPE_BRING_UP and WIFI_MESSAGE_TYPE_TEAR_DOWN.
+ */
+typedef enum {
+  WIFI_STAGE_DRIVER,
+  WIFI_STAGE_SUPPLICANT,
+  WIFI_STAGE_CONNECTION,
+  WIFI_STAGE_COUNT
+} WifiStage;
+
+#define WIFI_STAGE_NONE 0xffff
+
+/**
+ * Classes of supplicant events, for WIFI_MESSAGE_TYPE_SUBSCRIBE.
+ */
+typedef enum {
+  WIFI_EVENT_CLASS_CONNECTION = 1 << 0,
+  WIFI_EVENT_CLASS_SCAN = 1 << 1,
+  WIFI_EVENT_CLASS_P2P = 1 << 2,
+  WIFI_EVENT_CLASS_WPS = 1 << 3,
+  WIFI_EVENT_CLASS_DRIVER = 1 << 4,
+  WIFI_EVENT_CLASS_OTHER = 1 << 5
+} WifiEventClass;
+
+#define WIFI_EVENT_CLASS_ALL 0xffffffff
+
 /*
  * Notification Types.
  */
@@ -121,6 +225,31 @@ struct WifiMsgStartStopSupp {
   bool isP2pSupported;
 } __attribute__((packed));
 
+struct WifiMsgStageTimes {
+  uint16_t failedStage;                   // WIFI_STAGE_NONE on success
+  uint16_t numStages;                     // WIFI_STAGE_COUNT
+  uint32_t totalTime;                     // microseconds
+  uint32_t stageTime[WIFI_STAGE_COUNT];   // microseconds, 0 if not run
+} __attribute__((packed));
+
+struct WifiMsgSubscribe {
+  uint32_t eventMask;                     // WifiEventClass bits
+} __attribute__((packed));
+
+struct WifiMsgShmTransport {
+  uint32_t ringSize;
+} __attribute__((packed));
+
+struct WifiShmRing {
+  volatile uint32_t head;           // written by the producer only
+  uint8_t pad0[60];
+  volatile uint32_t tail;           // written by the consumer only
+  uint8_t pad1[60];
+  volatile uint32_t readerWaiting;
+  volatile uint32_t writerWaiting;
+  uint8_t pad2[56];
+};
+
 struct WifiMsgNotifyEvent {
   char eventMsg[];
 };
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiHal_h
+#define WifiHal_h
+
+#include <stdint.h>
+
+/**
+ * Driver and supplicant control. Every call may block for a long time and
+ * is only made from worker threads. Methods return 0 on success and -1 on
+ * failure.
+ */
+class WifiHal {
+public:
+  virtual int loadDriver() = 0;
+
+  virtual int unloadDriver() = 0;
+
+  virtual int startSupplicant(bool aP2pSupported) = 0;
+
+  virtual int stopSupplicant(bool aP2pSupported) = 0;
+
+  virtual ~WifiHal() = 0;
+};
+
+#endif // WifiHal_h
@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+#include "WifiBufferPool.h"
+#include "WifiDebug.h"
+#include "WifiIpcConnection.h"
+#include "WifiMessageHandler.h"
+#include "WifiShmIpcHandler.h"
+
+WifiIpcConnection::WifiIpcConnection(uint32_t aId, IpcHandler* aIpcHandler,
+  bool aOwnsHandler, WifiIpcManager* aIpcMgr, WifiMessageHandler* aMsgHandler)
+  : mId(aId)
+  , mIpcHandler(aIpcHandler)
+  , mOwnsHandler(aOwnsHandler)
+  , mIpcMgr(aIpcMgr)
+  , mMsgHandler(aMsgHandler)
+  , mWritePending(false)
+  , mFailed(false)
+  , mEventMask(WIFI_EVENT_CLASS_ALL)
+{
+  assert(aIpcHandler);
+  assert(aIpcMgr);
+  assert(aMsgHandler);
+
+  memset(&mQueueStats, 0, sizeof(mQueueStats));
+}
+
+WifiIpcConnection::~WifiIpcConnection()
+{
+  mIpcMgr->cancelTimer(this);
+  close();
+
+  while (!mOutQueue.empty()) {
+    WifiBufferPool::Instance()->release(mOutQueue.front().buf);
+    delete mOutQueue.front().stream;
+    mOutQueue.pop_front();
+  }
+
+  if (mOwnsHandler) {
+    delete mIpcHandler;
+  }
+}
+
+int
+WifiIpcConnection::write(uint8_t* aData, size_t aDataLen)
+{
+  struct iovec iov;
+
+  iov.iov_base = aData;
+  iov.iov_len = aDataLen;
+
+  return write(&iov, 1);
+}
+
+int
+WifiIpcConnection::write(const struct iovec* aIov, int aIovCnt)
+{
+  size_t total = 0;
+  int written = 0;
+
+  for (int i = 0; i < aIovCnt; i++) {
+    total += aIov[i].iov_len;
+  }
+
+  if (mFailed) {
+    return -1;
+  }
+
+  // Frames must not overtake the ones already queued.
+  if (mOutQueue.empty()) {
+    written = mIpcHandler->writevIpc(aIov, aIovCnt);
+
+    if (written < 0) {
+      WIFID_ERROR("WifiIpcConnection(%u): Error when writing data.", mId);
+      fail();
+      return -1;
+    }
+
+    if (static_cast<size_t>(written) == total) {
+      return 0;
+    }
+  }
+
+  return enqueue(aIov, aIovCnt, written);
+}
+
+int
+WifiIpcConnection::enqueue(const struct iovec* aIov, int aIovCnt, size_t aSkip)
+{
+  OutFrame frame;
+  size_t offset = 0;
+
+  frame.len = 0;
+  for (int i = 0; i < aIovCnt; i++) {
+    frame.len += aIov[i].iov_len;
+  }
+  frame.len -= aSkip;
+  frame.offset = 0;
+  frame.stream = NULL;
+
+  // The tail of a partially written frame is always kept, or the stream
+  // would lose its framing. Past that, a lost frame would leave a session
+  // or a chunked series unfinished for good, so the peer is dropped.
+  if (aSkip == 0 && mQueueStats.bytes + frame.len > MAX_QUEUE_BYTES) {
+    mQueueStats.dropped++;
+    WIFID_WARNING("WifiIpcConnection(%u): Outbound queue full, close the "
+      "connection.", mId);
+    fail();
+    return -1;
+  }
+
+  frame.buf = WifiBufferPool::Instance()->alloc(frame.len);
+  if (!frame.buf) {
+    mQueueStats.dropped++;
+    fail();
+    return -1;
+  }
+
+  for (int i = 0; i < aIovCnt; i++) {
+    const uint8_t* base = static_cast<const uint8_t*>(aIov[i].iov_base);
+    size_t len = aIov[i].iov_len;
+
+    if (aSkip >= len) {
+      aSkip -= len;
+      continue;
+    }
+
+    memcpy(frame.buf + offset, base + aSkip, len - aSkip);
+    offset += len - aSkip;
+    aSkip = 0;
+  }
+
+  mOutQueue.push_back(frame);
+  mQueueStats.depth++;
+  mQueueStats.bytes += frame.len;
+
+  if (mQueueStats.depth > mQueueStats.highWaterDepth) {
+    mQueueStats.highWaterDepth = mQueueStats.depth;
+  }
+  if (mQueueStats.bytes > mQueueStats.highWaterBytes) {
+    mQueueStats.highWaterBytes = mQueueStats.bytes;
+  }
+
+  setWritePending(true);
+
+  return 0;
+}
+
+int
+WifiIpcConnection::writeStream(WifiOutStream* aStream)
+{
+  OutFrame frame;
+
+  assert(aStream);
+
+  if (mFailed) {
+    delete aStream;
+    return -1;
+  }
+
+  frame.buf = WifiBufferPool::Instance()->alloc(WIFI_MESSAGE_MAX_FRAME_SIZE);
+  if (!frame.buf) {
+    delete aStream;
+    mQueueStats.dropped++;
+    fail();
+    return -1;
+  }
+  frame.len = 0;
+  frame.offset = 0;
+  frame.stream = aStream;
+
+  mOutQueue.push_back(frame);
+  mQueueStats.depth++;
+
+  if (mOutQueue.size() > 1) {
+    setWritePending(true);
+    return 0;
+  }
+
+  if (flush() < 0) {
+    WIFID_ERROR("WifiIpcConnection(%u): Error when flushing data.", mId);
+    fail();
+    return -1;
+  }
+
+  if (!mOutQueue.empty()) {
+    setWritePending(true);
+  }
+
+  return 0;
+}
+
+int
+WifiIpcConnection::pullStreams()
+{
+  ssize_t length;
+
+  // A stream at the head produces its next frame once the previous one
+  // is written.
+  while (!mOutQueue.empty() && mOutQueue.front().stream &&
+         mOutQueue.front().offset == mOutQueue.front().len) {
+    OutFrame& frame = mOutQueue.front();
+
+    length = frame.stream->nextFrame(frame.buf, WIFI_MESSAGE_MAX_FRAME_SIZE);
+
+    if (length > 0) {
+      frame.len = length;
+      frame.offset = 0;
+      mQueueStats.bytes += length;
+      if (mQueueStats.bytes > mQueueStats.highWaterBytes) {
+        mQueueStats.highWaterBytes = mQueueStats.bytes;
+      }
+      return 0;
+    }
+
+    if (length < 0) {
+      WIFID_ERROR("WifiIpcConnection(%u): Stream failed.", mId);
+    }
+
+    WifiBufferPool::Instance()->release(frame.buf);
+    delete frame.stream;
+    mOutQueue.pop_front();
+    mQueueStats.depth--;
+
+    if (length < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int
+WifiIpcConnection::flush()
+{
+  struct iovec iov[MAX_FLUSH_FRAMES];
+  int count;
+  int written;
+
+  while (!mOutQueue.empty()) {
+    if (pullStreams() < 0) {
+      return -1;
+    }
+
+    count = 0;
+    for (std::deque<OutFrame>::iterator it = mOutQueue.begin();
+         it != mOutQueue.end() && count < MAX_FLUSH_FRAMES; ++it) {
+      // Only the current frame of a stream is ready, nothing may pass it.
+      if (it->stream && it != mOutQueue.begin()) {
+        break;
+      }
+
+      iov[count].iov_base = it->buf + it->offset;
+      iov[count].iov_len = it->len - it->offset;
+      count++;
+
+      if (it->stream) {
+        break;
+      }
+    }
+
+    if (count == 0) {
+      break;
+    }
+
+    written = mIpcHandler->writeFramesIpc(iov, count);
+    mQueueStats.flushes++;
+
+    if (written < 0) {
+      return -1;
+    }
+
+    if (written == 0) {
+      // Still full, wait for the next EPOLLOUT.
+      return 0;
+    }
+
+    consume(written);
+  }
+
+  setWritePending(false);
+
+  return 0;
+}
+
+void
+WifiIpcConnection::consume(size_t aLength)
+{
+  while (aLength > 0 && !mOutQueue.empty()) {
+    OutFrame& frame = mOutQueue.front();
+    size_t remain = frame.len - frame.offset;
+
+    if (aLength < remain) {
+      frame.offset += aLength;
+      mQueueStats.bytes -= aLength;
+      return;
+    }
+
+    aLength -= remain;
+    mQueueStats.bytes -= remain;
+
+    if (frame.stream) {
+      // Keep the stream queued for its next frame.
+      frame.offset = frame.len;
+      return;
+    }
+
+    mQueueStats.depth--;
+    WifiBufferPool::Instance()->release(frame.buf);
+    mOutQueue.pop_front();
+  }
+}
+
+void
+WifiIpcConnection::setWritePending(bool aPending)
+{
+  if (mWritePending == aPending) {
+    return;
+  }
+
+  mWritePending = aPending;
+  mIpcMgr->modifyPollFd(getFd(), aPending ? (EPOLLIN | EPOLLOUT) : EPOLLIN, this);
+}
+
+void
+WifiIpcConnection::fail()
+{
+  if (!mFailed) {
+    mFailed = true;
+    mIpcMgr->setTimer(this, 0);
+  }
+}
+
+void
+WifiIpcConnection::onTimer()
+{
+  mIpcMgr->closeConnection(this);
+}
+
+void
+WifiIpcConnection::getQueueStats(struct WifiIpcQueueStats* aStats)
+{
+  assert(aStats);
+
+  *aStats = mQueueStats;
+}
+
+int
+WifiIpcConnection::upgradeToShm(const uint8_t* aFrame, size_t aLength)
+{
+  WifiShmIpcHandler* shm;
+
+  // Queued frames would have to follow the handshake on the socket.
+  if (!mOutQueue.empty()) {
+    WIFID_WARNING("WifiIpcConnection(%u): Frames queued, keep the socket.", mId);
+    return -1;
+  }
+
+  shm = WifiShmIpcHandler::create(mIpcHandler);
+  if (!shm) {
+    return -1;
+  }
+
+  if (shm->sendHandshake(aFrame, aLength) < 0) {
+    delete shm;
+    return -1;
+  }
+
+  mIpcMgr->removePollFd(mIpcHandler->getFd());
+
+  shm->setOwnsSocket(mOwnsHandler);
+  mIpcHandler = shm;
+  mOwnsHandler = true;
+  mWritePending = false;
+
+  if (mIpcMgr->addPollFd(getFd(), EPOLLIN, this) < 0) {
+    return -1;
+  }
+
+  WIFID_DEBUG("WifiIpcConnection(%u): Moved to shared memory.", mId);
+
+  return 0;
+}
+
+void
+WifiIpcConnection::close()
+{
+  if (mIpcHandler->isConnected()) {
+    WIFID_DEBUG("WifiIpcConnection(%u): Queue high water %u frames, %u bytes, "
+      "%u dropped.", mId, mQueueStats.highWaterDepth,
+      mQueueStats.highWaterBytes, mQueueStats.dropped);
+    mIpcHandler->closeIpc();
+  }
+}
+
+void
+WifiIpcConnection::onPollEvent(uint32_t aEvents)
+{
+  if (aEvents & EPOLLIN) {
+    if (receive() <= 0) {
+      mIpcMgr->closeConnection(this);
+      return;
+    }
+  } else if (aEvents & (EPOLLERR | EPOLLHUP)) {
+    WIFID_DEBUG("WifiIpcConnection(%u): Peer hung up.", mId);
+    mIpcMgr->closeConnection(this);
+    return;
+  }
+
+  // Shared memory reports room in its ring as EPOLLIN.
+  if ((aEvents & EPOLLOUT) || (mWritePending && (aEvents & EPOLLIN))) {
+    if (flush() < 0) {
+      WIFID_ERROR("WifiIpcConnection(%u): Error when flushing data.", mId);
+      mIpcMgr->closeConnection(this);
+    }
+  }
+}
+
+int
+WifiIpcConnection::receive()
+{
+  uint8_t* buf;
+  size_t space;
+  int length;
+  uint8_t* msg;
+  size_t msgLen;
+  int status;
+
+  // Packets must be read whole.
+  buf = mDecoder.getWriteBuffer(&space, mIpcHandler->getNextPacketSize());
+
+  if (!buf) {
+    WIFID_ERROR("WifiIpcConnection(%u): No memory for receiving data.", mId);
+    return -1;
+  }
+
+  length = mIpcHandler->readIpc(buf, space);
+
+  if (length == 0) {
+    WIFID_DEBUG("WifiIpcConnection(%u): End of socket.", mId);
+    return 0;
+  } else if (length < 0) {
+    if (errno == EAGAIN || errno == EINTR) {
+      return 1;
+    }
+    WIFID_ERROR("WifiIpcConnection(%u): Error when reading data: %s",
+      mId, strerror(errno));
+    return -1;
+  }
+
+  mDecoder.commit(length);
+
+  // One read may carry several messages, or only part of one.
+  while ((status = mDecoder.nextMessage(&msg, &msgLen)) > 0) {
+    if (mMsgHandler->processMsg(mId, msg, msgLen) < 0) {
+      WIFID_ERROR("WifiIpcConnection(%u): Error when processing data.", mId);
+    }
+  }
+
+  if (status < 0) {
+    WIFID_ERROR("WifiIpcConnection(%u): Malformed message stream.", mId);
+    return -1;
+  }
+
+  return length;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiIpcConnection_h
+#define WifiIpcConnection_h
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <deque>
+
+#include "IpcHandler.h"
+#include "WifiGonkMessage.h"
+#include "WifiIpcManager.h"
+#include "WifiMessageDecoder.h"
+
+class WifiMessageHandler;
+
+/**
+ * A message sent as a series of frames, produced one at a time.
+ */
+class WifiOutStream
+{
+public:
+  // Writes the next frame into aBuf. Returns its length, 0 once the
+  // stream is over, or -1 on error.
+  virtual ssize_t nextFrame(uint8_t* aBuf, size_t aBufLen) = 0;
+
+  virtual ~WifiOutStream() {}
+};
+
+struct WifiIpcQueueStats {
+  uint32_t depth;           // frames waiting in the outbound queue
+  uint32_t bytes;           // bytes waiting in the outbound queue
+  uint32_t highWaterDepth;
+  uint32_t highWaterBytes;
+  uint32_t flushes;         // writes issued from the queue
+  uint32_t dropped;         // frames the queue had no room for, which
+                            // closed the connection
+};
+
+/**
+ * One client of the daemon. Each connection owns its receive state, so a
+ * slow or partial sender never holds up the messages of other clients.
+ *
+ * Outgoing frames are written right away when the socket accepts them.
+ * Whatever does not fit is queued and flushed, several frames per
+ * syscall, once epoll reports the socket writable again.
+ *
+ * Once upgraded to shared memory, the rings are written instead of the
+ * socket. Their epoll descriptor never reports EPOLLOUT, room in the
+ * outgoing ring shows up as EPOLLIN.
+ *
+ * A stream takes one place in the queue. Its next frame is only pulled
+ * once the previous one is written, so a large message never sits in
+ * memory as a whole and the frames after it keep their order.
+ *
+ * A peer that lets the queue grow past MAX_QUEUE_BYTES is dropped rather
+ * than any of its frames. A connection that can not be written any more
+ * is closed from the loop, as the writer may be walking the connections
+ * or running one of its requests.
+ */
+class WifiIpcConnection
+  : public WifiPollListener
+  , public WifiTimerListener
+{
+public:
+  static const size_t MAX_QUEUE_BYTES = 256 * 1024;
+  static const int MAX_FLUSH_FRAMES = 16;
+
+  WifiIpcConnection(uint32_t aId, IpcHandler* aIpcHandler, bool aOwnsHandler,
+                    WifiIpcManager* aIpcMgr, WifiMessageHandler* aMsgHandler);
+  ~WifiIpcConnection();
+
+  uint32_t getId()
+  {
+    return mId;
+  }
+
+  int getFd()
+  {
+    return mIpcHandler->getFd();
+  }
+
+  // WifiEventClass bits of the events the peer wants.
+  uint32_t getEventMask()
+  {
+    return mEventMask;
+  }
+
+  void setEventMask(uint32_t aEventMask)
+  {
+    mEventMask = aEventMask;
+  }
+
+  int write(uint8_t* aData, size_t aDataLen);
+  int write(const struct iovec* aIov, int aIovCnt);
+  // Takes the ownership of aStream.
+  int writeStream(WifiOutStream* aStream);
+  // Sends the handshake response aFrame and moves the connection over to
+  // a shared memory transport. Fails, leaving the socket in use, if
+  // frames are still queued or shared memory is not available.
+  int upgradeToShm(const uint8_t* aFrame, size_t aLength);
+  void close();
+
+  void getQueueStats(struct WifiIpcQueueStats* aStats);
+
+  void onPollEvent(uint32_t aEvents);
+  void onTimer();
+
+private:
+  struct OutFrame {
+    uint8_t* buf;
+    size_t len;
+    size_t offset;
+    WifiOutStream* stream;
+  };
+
+  int receive();
+  int enqueue(const struct iovec* aIov, int aIovCnt, size_t aSkip);
+  int flush();
+  int pullStreams();
+  void consume(size_t aLength);
+  void setWritePending(bool aPending);
+  void fail();
+
+  uint32_t mId;
+  IpcHandler* mIpcHandler;
+  bool mOwnsHandler;
+  WifiIpcManager* mIpcMgr;
+  WifiMessageHandler* mMsgHandler;
+  WifiMessageDecoder mDecoder;
+  std::deque<OutFrame> mOutQueue;
+  bool mWritePending;
+  bool mFailed;
+  uint32_t mEventMask;
+  struct WifiIpcQueueStats mQueueStats;
+};
+
+#endif // WifiIpcConnection_h
@@ -18,10 +18,12 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <poll.h>
+#include <string.h>
 #include <netinet/in.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "WifiDebug.h"
 #include "WifiIpcHandler.h"
@@ -36,6 +38,16 @@ WifiIpcHandler::WifiIpcHandler(int aSockMode, const char* aSockName, bool aIsSeq
 {
 }
 
+WifiIpcHandler::WifiIpcHandler(int aFd, bool aIsSeqPacket)
+  : mRwFd(aFd)
+  , mConnFd(-1)
+  , mSockMode(ACCEPTED_MODE)
+  , mSockName(NULL)
+  , mIsSeqPacket(aIsSeqPacket)
+  , mIsConnected(true)
+{
+}
+
 WifiIpcHandler::~WifiIpcHandler()
 {
   closeIpc();
@@ -63,6 +75,10 @@ WifiIpcHandler::openIpc()
       WIFID_ERROR("Could not recognize the socket mode(%d).\n", mSockMode);
   }
 
+  if (ret < 0) {
+    return ret;
+  }
+
   settingSocket();
 
   mIsConnected = true;
@@ -73,37 +89,141 @@ WifiIpcHandler::openIpc()
 int
 WifiIpcHandler::readIpc(uint8_t* aData, size_t aDataLen)
 {
+  struct iovec iov;
+  struct msghdr msg;
+  ssize_t size;
+
   if (!mIsConnected) {
     return -1;
   }
 
-  return read(mRwFd, aData, aDataLen);
+  if (!mIsSeqPacket) {
+    return read(mRwFd, aData, aDataLen);
+  }
+
+  iov.iov_base = aData;
+  iov.iov_len = aDataLen;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  size = recvmsg(mRwFd, &msg, 0);
+
+  // The rest of a packet that does not fit is lost.
+  if (size >= 0 && (msg.msg_flags & MSG_TRUNC)) {
+    WIFID_ERROR("Packet larger than %zu bytes.", aDataLen);
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  return size;
+}
+
+size_t
+WifiIpcHandler::getNextPacketSize()
+{
+  ssize_t size;
+
+  if (!mIsConnected || !mIsSeqPacket) {
+    return 0;
+  }
+
+  size = recv(mRwFd, NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+
+  return size > 0 ? size : 0;
 }
 
 int
 WifiIpcHandler::writeIpc(uint8_t* aData, size_t aDataLen)
 {
-  size_t writeOffset = 0;
   int size;
 
   if (!mIsConnected) {
     return -1;
   }
 
-  while (writeOffset < aDataLen) {
-    do {
-      size = write(mRwFd, aData + writeOffset, aDataLen - writeOffset);
-    } while (size < 0 && errno == EINTR);
+  // Never waits on a slow reader, the caller keeps what is left.
+  size = TEMP_FAILURE_RETRY(
+    send(mRwFd, aData, aDataLen, MSG_NOSIGNAL | MSG_DONTWAIT));
 
-    if (size < 0) {
-      WIFID_ERROR("Response: unexpected error on write errno:%d", errno);
-      return -1;
+  if (size < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    WIFID_ERROR("Response: unexpected error on write errno:%d", errno);
+  }
+
+  return size;
+}
+
+int
+WifiIpcHandler::writevIpc(const struct iovec* aIov, int aIovCnt)
+{
+  struct msghdr msg;
+  ssize_t size;
+
+  if (!mIsConnected) {
+    return -1;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = const_cast<struct iovec*>(aIov);
+  msg.msg_iovlen = aIovCnt;
+
+  do {
+    size = sendmsg(mRwFd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  } while (size < 0 && errno == EINTR);
+
+  if (size < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
     }
+    WIFID_ERROR("Response: unexpected error on writev errno:%d", errno);
+    return -1;
+  }
+
+  return size;
+}
 
-    writeOffset += size;
+int
+WifiIpcHandler::writeFramesIpc(const struct iovec* aFrames, int aCount)
+{
+  struct mmsghdr msgs[MAX_IOV];
+  int count;
+  int sent;
+  size_t size = 0;
+
+  if (!mIsSeqPacket) {
+    // A stream carries the frames back to back.
+    return writevIpc(aFrames, aCount < MAX_IOV ? aCount : MAX_IOV);
   }
 
-  return 0;
+  if (!mIsConnected) {
+    return -1;
+  }
+
+  // Each frame must stay one packet.
+  count = aCount < MAX_IOV ? aCount : MAX_IOV;
+  memset(msgs, 0, count * sizeof(struct mmsghdr));
+  for (int i = 0; i < count; i++) {
+    msgs[i].msg_hdr.msg_iov = const_cast<struct iovec*>(aFrames + i);
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  do {
+    sent = sendmmsg(mRwFd, msgs, count, MSG_NOSIGNAL | MSG_DONTWAIT);
+  } while (sent < 0 && errno == EINTR);
+
+  if (sent < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+    WIFID_ERROR("Response: unexpected error on sendmmsg errno:%d", errno);
+    return -1;
+  }
+
+  for (int i = 0; i < sent; i++) {
+    size += msgs[i].msg_len;
+  }
+
+  return size;
 }
 
 int
@@ -131,10 +251,12 @@ int WifiIpcHandler::closeIpc()
 {
   if (mRwFd != -1) {
     close(mRwFd);
+    mRwFd = -1;
   }
 
   if (mConnFd != -1) {
     close(mConnFd);
+    mConnFd = -1;
   }
 
   mIsConnected = false;
@@ -162,7 +284,7 @@ WifiIpcHandler::openConnectSocket()
   socklen_t addrLen = offsetof(struct sockaddr_un, sun_path) + siz;
 
   mRwFd = socket(AF_UNIX, mIsSeqPacket ? SOCK_SEQPACKET : SOCK_STREAM, 0);
-  if (mConnFd < 0) {
+  if (mRwFd < 0) {
     WIFID_ERROR("Could not create %s socket: %s\n", mSockName, strerror(errno));
     return -1;
   }
@@ -172,6 +294,7 @@ WifiIpcHandler::openConnectSocket()
   if (res < 0) {
     WIFID_ERROR("Could not connect %s socket: %s\n", mSockName, strerror(errno));
     close(mRwFd);
+    mRwFd = -1;
     return -1;
   }
 
@@ -181,10 +304,10 @@ WifiIpcHandler::openConnectSocket()
 int
 WifiIpcHandler::openListenSocket()
 {
-  struct sockaddr_un hostaddr, peeraddr;
-  socklen_t socklen = sizeof(hostaddr);
+  struct sockaddr_un hostaddr;
+  socklen_t socklen;
   int ret;
-  size_t len, siz;
+  size_t len;
 
   len = strlen(mSockName);
   if ((len + NBOUNDS) > UNIX_PATH_MAX) {
@@ -202,32 +325,67 @@ WifiIpcHandler::openListenSocket()
   hostaddr.sun_family = AF_UNIX;
   hostaddr.sun_path[0] = '\0'; /* abstract socket namespace */
   memcpy(hostaddr.sun_path + 1, mSockName, len + 1);
+  socklen = offsetof(struct sockaddr_un, sun_path) + len + NBOUNDS;
 
   ret = bind(mConnFd, reinterpret_cast<struct sockaddr*>(&hostaddr), socklen);
 
   if (ret < 0) {
     WIFID_ERROR("Could not bind %s socket: %s\n", mSockName, strerror(errno));
     close(mConnFd);
+    mConnFd = -1;
     return -1;
   }
 
-  ret = listen(mConnFd, 4);
+  ret = listen(mConnFd, LISTEN_BACKLOG);
 
   if (ret < 0) {
     WIFID_ERROR("Could not listen %s socket: %s\n", mSockName, strerror(errno));
     close(mConnFd);
+    mConnFd = -1;
     return -1;
   }
 
-  mRwFd = accept(mConnFd, (struct sockaddr*)&peeraddr, &socklen);
+  // Peers are accepted by acceptIpc() as they arrive.
+  return 0;
+}
 
-  if (mRwFd < 0) {
-    WIFID_ERROR("Error on accept(): %s\n", strerror(errno));
-    close(mConnFd);
-    return -1;
+IpcHandler*
+WifiIpcHandler::acceptIpc()
+{
+  struct sockaddr_un peeraddr;
+  socklen_t socklen = sizeof(peeraddr);
+  int fd;
+
+  if (!mIsConnected || mSockMode != LISTEN_MODE) {
+    return NULL;
   }
 
-  return 0;
+  fd = TEMP_FAILURE_RETRY(
+    accept(mConnFd, reinterpret_cast<struct sockaddr*>(&peeraddr), &socklen));
+
+  if (fd < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      WIFID_ERROR("Error on accept(): %s\n", strerror(errno));
+    }
+    return NULL;
+  }
+
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  return new WifiIpcHandler(fd, mIsSeqPacket);
+}
+
+bool
+WifiIpcHandler::isListening()
+{
+  return mIsConnected && mSockMode == LISTEN_MODE;
+}
+
+int
+WifiIpcHandler::getFd()
+{
+  return isListening() ? mConnFd : mRwFd;
 }
 
 bool
@@ -239,7 +397,9 @@ WifiIpcHandler::isConnected()
 void
 WifiIpcHandler::settingSocket()
 {
-  int ret = fcntl(mConnFd, F_SETFL, O_NONBLOCK);
+  // The listening socket in listen mode, the peer socket otherwise.
+  int fd = (mSockMode == LISTEN_MODE) ? mConnFd : mRwFd;
+  int ret = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
   if (ret < 0) {
     WIFID_ERROR("Error setting O_NONBLOCK errno: %s\n", strerror(errno));
   }
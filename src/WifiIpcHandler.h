@@ -28,18 +28,33 @@ public:
 
   static const size_t NBOUNDS = 2; // respect leading and trailing '\0'
 
+  static const int MAX_IOV = 16;
+
+  static const int ACCEPTED_MODE = 3;
+
+  static const int LISTEN_BACKLOG = 8;
+
   WifiIpcHandler(int aSockMode, const char* aSockName, bool aIsSeqPacket);
   ~WifiIpcHandler();
 
   int openIpc();
   int readIpc(uint8_t* aData, size_t aDataLen);
+  size_t getNextPacketSize();
   int writeIpc(uint8_t* aData, size_t aDataLen);
+  int writevIpc(const struct iovec* aIov, int aIovCnt);
+  int writeFramesIpc(const struct iovec* aFrames, int aCount);
   int closeIpc();
   int waitForData();
 
   bool isConnected();
+  bool isListening();
+  IpcHandler* acceptIpc();
+  int getFd();
 
 private:
+  // Wraps a peer accepted on a listening socket.
+  WifiIpcHandler(int aFd, bool aIsSeqPacket);
+
   int openConnectSocket();
   int openListenSocket();
   void settingSocket();
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "WifiDebug.h"
+#include "WifiIpcLifecycle.h"
+#include "WifiStats.h"
+
+WifiIpcLifecycle::WifiIpcLifecycle()
+  : mConnected(false)
+  , mDownSince(WifiStats::getTime())
+  , mDelay(0)
+  , mSeed(static_cast<unsigned int>(mDownSince) ^ getpid())
+{
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+uint64_t
+WifiIpcLifecycle::onConnectFailed()
+{
+  uint64_t delay;
+
+  mStats.attempts++;
+
+  mDelay = mDelay ? mDelay * 2 : BASE_DELAY_US;
+  if (mDelay > MAX_DELAY_US) {
+    mDelay = MAX_DELAY_US;
+  }
+
+  // Somewhere between half and all of the backoff.
+  delay = mDelay / 2 + rand_r(&mSeed) % (mDelay / 2 + 1);
+
+  if (mStats.attempts % 100 == 1) {
+    WIFID_WARNING("Peer not available after %u attempts, retry in %" PRIu64 "ms.",
+      mStats.attempts, delay / 1000);
+  }
+
+  return delay;
+}
+
+void
+WifiIpcLifecycle::onConnected()
+{
+  uint64_t elapsed = WifiStats::getTime() - mDownSince;
+
+  mConnected = true;
+  mDelay = 0;
+  mStats.connects++;
+  mStats.lastConnectTime = elapsed;
+  if (elapsed > mStats.maxConnectTime) {
+    mStats.maxConnectTime = elapsed;
+  }
+
+  WIFID_DEBUG("Connected to the peer after %" PRIu64 "us, %u attempts.",
+    elapsed, mStats.attempts);
+}
+
+uint64_t
+WifiIpcLifecycle::onDisconnected()
+{
+  mConnected = false;
+  mDownSince = WifiStats::getTime();
+  mDelay = 0;
+
+  // The peer is most likely restarting, look for it at once.
+  return 0;
+}
+
+void
+WifiIpcLifecycle::reset()
+{
+  mDelay = 0;
+}
+
+void
+WifiIpcLifecycle::getStats(struct WifiIpcLifecycleStats* aStats)
+{
+  *aStats = mStats;
+}
+
+void
+WifiIpcLifecycle::report(std::string* aOut)
+{
+  char line[160];
+
+  snprintf(line, sizeof(line), "ipc %s connects %u attempts %u "
+    "last_connect %" PRIu64 "us max_connect %" PRIu64 "us\n",
+    mConnected ? "up" : "down", mStats.connects, mStats.attempts,
+    mStats.lastConnectTime, mStats.maxConnectTime);
+  aOut->append(line);
+}
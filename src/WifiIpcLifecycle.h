@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiIpcLifecycle_h
+#define WifiIpcLifecycle_h
+
+#include <stdint.h>
+#include <string>
+
+struct WifiIpcLifecycleStats {
+  uint32_t connects;          // successful opens, the first one included
+  uint32_t attempts;          // failed opens
+  uint64_t lastConnectTime;   // microseconds from down to connected
+  uint64_t maxConnectTime;
+};
+
+/**
+ * Reconnection policy of the socket to the peer. A failed open is
+ * retried after a delay doubling from BASE_DELAY_US up to MAX_DELAY_US,
+ * randomly shortened by up to half so restarting peers do not retry in
+ * lockstep. A lost connection is retried right away, as is every open
+ * after reset().
+ *
+ * Also records how long the daemon stayed without a connection.
+ *
+ * Only used from the thread running WifiIpcManager::loop().
+ */
+class WifiIpcLifecycle
+{
+public:
+  static const uint64_t BASE_DELAY_US = 5000;
+  static const uint64_t MAX_DELAY_US = 500000;
+
+  WifiIpcLifecycle();
+
+  // Returns the delay before the next attempt.
+  uint64_t onConnectFailed();
+  void onConnected();
+  // Returns the delay before the first attempt.
+  uint64_t onDisconnected();
+
+  // Restarts the backoff from its base.
+  void reset();
+
+  bool isConnected()
+  {
+    return mConnected;
+  }
+
+  void getStats(struct WifiIpcLifecycleStats* aStats);
+
+  // Appends a one line text report.
+  void report(std::string* aOut);
+
+private:
+  bool mConnected;
+  uint64_t mDownSince;
+  uint64_t mDelay;
+  unsigned int mSeed;
+  struct WifiIpcLifecycleStats mStats;
+};
+
+#endif // WifiIpcLifecycle_h
@@ -14,13 +14,50 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 #include "WifiDebug.h"
+#include "WifiIpcConnection.h"
 #include "WifiIpcManager.h"
 #include "WifiMessageHandler.h"
+#include "WifiStats.h"
 
-const size_t MAX_BUFSIZE = 4096;
+/**
+ * Retries to open the socket at once when a signal arrives, read from a
+ * signalfd on the loop thread.
+ */
+class WifiReconnectSignal
+  : public WifiPollListener
+{
+public:
+  WifiReconnectSignal(WifiIpcManager* aIpcMgr, int aFd)
+    : mIpcMgr(aIpcMgr)
+    , mFd(aFd)
+  {
+  }
+
+  void onPollEvent(uint32_t aEvents)
+  {
+    struct signalfd_siginfo info;
+
+    while (TEMP_FAILURE_RETRY(read(mFd, &info, sizeof(info))) == sizeof(info)) {
+      mIpcMgr->reconnectNow();
+    }
+  }
+
+private:
+  WifiIpcManager* mIpcMgr;
+  int mFd;
+};
 
 WifiIpcManager* WifiIpcManager::sInstance = NULL;
 
@@ -35,11 +72,19 @@ WifiIpcManager::Instance() {
 WifiIpcManager::WifiIpcManager()
   : mIpcHandler(NULL)
   , mMsgHandler(NULL)
+  , mEpollFd(-1)
+  , mNextConnId(1)
 {
 }
 
 WifiIpcManager::~WifiIpcManager()
 {
+  closeAllConnections();
+  reapConnections();
+
+  if (mEpollFd != -1) {
+    close(mEpollFd);
+  }
 }
 
 void
@@ -53,67 +98,483 @@ WifiIpcManager::init(IpcHandler* aIpcHandler, WifiMessageHandler* aMsgHandler)
   mIpcHandler = aIpcHandler;
   mMsgHandler = aMsgHandler;
 
+  mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (mEpollFd < 0) {
+    WIFID_ERROR("Could not create epoll: %s", strerror(errno));
+  }
+
   // open Socket
   ret = mIpcHandler->openIpc();
 
   if (ret < 0) {
-    WIFID_ERROR("The initialization of the ipc manager fail.");
+    WIFID_DEBUG("Peer not available yet, retried from loop().");
   }
 }
 
 void
 WifiIpcManager::loop()
 {
-  int ret;
-  uint8_t buf[MAX_BUFSIZE];
-  int length;
+  struct epoll_event events[MAX_EVENTS];
+  int n;
+
+  connect();
+
   while (1) {
+    n = epoll_wait(mEpollFd, events, MAX_EVENTS, getTimeout());
 
-    // open Socket
-    ret = mIpcHandler->openIpc();
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      WIFID_ERROR("WifiIpcManager: Error when waiting data: %s\n", strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      static_cast<WifiPollListener*>(events[i].data.ptr)->onPollEvent(
+        events[i].events);
+    }
+
+    reapConnections();
+    runTimers();
+
+    if (mLifecycle.isConnected() && !mIpcHandler->isConnected()) {
+      disconnect();
+    }
+  }
+
+  if (mLifecycle.isConnected()) {
+    disconnect();
+  }
+}
+
+void
+WifiIpcManager::onTimer()
+{
+  connect();
+}
+
+void
+WifiIpcManager::connect()
+{
+  int ret;
+
+  if (mLifecycle.isConnected()) {
+    return;
+  }
+
+  ret = mIpcHandler->openIpc();
+
+  if (ret == 0) {
+    if (mIpcHandler->isListening()) {
+      // Serve every peer connecting to the listening socket.
+      ret = addPollFd(mIpcHandler->getFd(), EPOLLIN, this);
+    } else {
+      // The connected socket is the only client.
+      ret = openConnection(mIpcHandler, false) ? 0 : -1;
+    }
 
     if (ret < 0) {
-      WIFID_ERROR("WifiIpcManager: Fail to open Ipc: %s\n", strerror(errno));
-      continue;
+      mIpcHandler->closeIpc();
     }
+  }
+
+  if (ret < 0) {
+    setTimer(this, mLifecycle.onConnectFailed());
+    return;
+  }
 
-    while(mIpcHandler->isConnected()) {
-      ret = mIpcHandler->waitForData();
+  mLifecycle.onConnected();
+}
 
-      if (ret < 0) {
-        WIFID_ERROR("WifiIpcManager: Error when waiting data: %s\n", strerror(errno));
-        continue;
-      }
+void
+WifiIpcManager::disconnect()
+{
+  if (mIpcHandler->isListening()) {
+    removePollFd(mIpcHandler->getFd());
+  }
 
-      memset(buf, 0, MAX_BUFSIZE * sizeof(uint8_t));
+  closeAllConnections();
+  reapConnections();
+  mIpcHandler->closeIpc();
 
-      length = mIpcHandler->readIpc(buf, MAX_BUFSIZE);
+  setTimer(this, mLifecycle.onDisconnected());
+}
 
-      if (length == 0) {
-        WIFID_DEBUG("WifiIpcManager: End of socket.");
-        break;
-      } else if (length < 0) {
-        WIFID_ERROR("WifiIpcManager: Error when reading data: %s\n", strerror(errno));
-        break;
-      }
+void
+WifiIpcManager::reconnectNow()
+{
+  if (mLifecycle.isConnected()) {
+    return;
+  }
 
-      ret = mMsgHandler->processMsg(buf, length);
+  mLifecycle.reset();
+  setTimer(this, 0);
+}
 
-      if (ret < 0) {
-        WIFID_ERROR("WifiIpcManager: Error when processing data.\n");
-      }
+int
+WifiIpcManager::watchReconnectSignal(int aSignal)
+{
+  sigset_t mask;
+  int fd;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, aSignal);
+
+  fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    WIFID_ERROR("Could not create the signalfd: %s", strerror(errno));
+    return -1;
+  }
+
+  if (addPollFd(fd, EPOLLIN, new WifiReconnectSignal(this, fd)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+WifiIpcManager::reportLifecycle(std::string* aOut)
+{
+  mLifecycle.report(aOut);
+}
+
+void
+WifiIpcManager::reportQueues(std::string* aOut)
+{
+  std::map<uint32_t, WifiIpcConnection*>::iterator it;
+  struct WifiIpcQueueStats stats;
+  char line[160];
+
+  for (it = mConnections.begin(); it != mConnections.end(); ++it) {
+    it->second->getQueueStats(&stats);
+    snprintf(line, sizeof(line), "connection %u queue depth %u bytes %u "
+      "max_depth %u max_bytes %u flushes %u dropped %u\n", it->first,
+      stats.depth, stats.bytes, stats.highWaterDepth, stats.highWaterBytes,
+      stats.flushes, stats.dropped);
+    aOut->append(line);
+  }
+}
+
+void
+WifiIpcManager::setTimer(WifiTimerListener* aListener, uint64_t aDelayUs)
+{
+  assert(aListener);
+
+  mTimers[aListener] = WifiStats::getTime() + aDelayUs;
+}
+
+void
+WifiIpcManager::cancelTimer(WifiTimerListener* aListener)
+{
+  mTimers.erase(aListener);
+}
+
+int
+WifiIpcManager::getTimeout()
+{
+  std::map<WifiTimerListener*, uint64_t>::iterator it;
+  uint64_t now;
+  uint64_t next = UINT64_MAX;
+
+  if (mTimers.empty()) {
+    return -1;
+  }
+
+  // A handful of timers at most, a scan is cheaper than a heap.
+  for (it = mTimers.begin(); it != mTimers.end(); ++it) {
+    if (it->second < next) {
+      next = it->second;
+    }
+  }
+
+  now = WifiStats::getTime();
+  if (next <= now) {
+    return 0;
+  }
+
+  // Round up, waking before the deadline would only spin.
+  return (next - now + 999) / 1000;
+}
+
+void
+WifiIpcManager::runTimers()
+{
+  std::map<WifiTimerListener*, uint64_t>::iterator it;
+  std::vector<WifiTimerListener*> expired;
+  uint64_t now;
+
+  if (mTimers.empty()) {
+    return;
+  }
+
+  now = WifiStats::getTime();
+
+  for (it = mTimers.begin(); it != mTimers.end();) {
+    if (it->second <= now) {
+      expired.push_back(it->first);
+      mTimers.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  // Listeners may set timers again from onTimer().
+  for (size_t i = 0; i < expired.size(); i++) {
+    expired[i]->onTimer();
+  }
+}
+
+void
+WifiIpcManager::onPollEvent(uint32_t aEvents)
+{
+  IpcHandler* handler;
+
+  if (!(aEvents & EPOLLIN)) {
+    return;
+  }
+
+  while ((handler = mIpcHandler->acceptIpc())) {
+    if (mConnections.size() >= MAX_CONNECTIONS) {
+      WIFID_WARNING("WifiIpcManager: Too many connections, reject the peer.");
+      delete handler;
+      continue;
     }
 
-    mIpcHandler->closeIpc();
+    openConnection(handler, true);
+  }
+}
+
+WifiIpcConnection*
+WifiIpcManager::openConnection(IpcHandler* aIpcHandler, bool aOwnsHandler)
+{
+  WifiIpcConnection* conn;
+  uint32_t id = mNextConnId++;
+
+  // Connection id 0 is never handed out.
+  if (mNextConnId == 0) {
+    mNextConnId = 1;
+  }
+
+  conn = new WifiIpcConnection(id, aIpcHandler, aOwnsHandler, this, mMsgHandler);
+
+  if (addPollFd(conn->getFd(), EPOLLIN, conn) < 0) {
+    delete conn;
+    return NULL;
   }
+
+  mConnections[id] = conn;
+
+  WIFID_DEBUG("WifiIpcManager: Connection %u opened.", id);
+
+  return conn;
+}
+
+void
+WifiIpcManager::closeConnection(WifiIpcConnection* aConn)
+{
+  std::map<uint32_t, WifiIpcConnection*>::iterator it;
+
+  assert(aConn);
+
+  it = mConnections.find(aConn->getId());
+  if (it == mConnections.end()) {
+    return;
+  }
+
+  mConnections.erase(it);
+  removePollFd(aConn->getFd());
+  mMsgHandler->removeConnection(aConn->getId());
+  aConn->close();
+
+  WIFID_DEBUG("WifiIpcManager: Connection %u closed.", aConn->getId());
+
+  // Events of this iteration may still refer to the connection.
+  mClosedConnections.push_back(aConn);
+}
+
+void
+WifiIpcManager::closeAllConnections()
+{
+  while (!mConnections.empty()) {
+    closeConnection(mConnections.begin()->second);
+  }
+}
+
+void
+WifiIpcManager::reapConnections()
+{
+  for (size_t i = 0; i < mClosedConnections.size(); i++) {
+    delete mClosedConnections[i];
+  }
+  mClosedConnections.clear();
+}
+
+int
+WifiIpcManager::addPollFd(int aFd, uint32_t aEvents, WifiPollListener* aListener)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = aEvents;
+  ev.data.ptr = aListener;
+
+  if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, aFd, &ev) < 0) {
+    WIFID_ERROR("Could not add fd(%d) to epoll: %s", aFd, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+WifiIpcManager::modifyPollFd(int aFd, uint32_t aEvents, WifiPollListener* aListener)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = aEvents;
+  ev.data.ptr = aListener;
+
+  if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, aFd, &ev) < 0) {
+    WIFID_ERROR("Could not modify fd(%d) in epoll: %s", aFd, strerror(errno));
+    return -1;
+  }
+
+  return 0;
 }
 
 int
-WifiIpcManager::writeToIpc(uint8_t* aData, size_t aDataLen)
+WifiIpcManager::removePollFd(int aFd)
 {
+  if (aFd < 0) {
+    return -1;
+  }
+
+  return epoll_ctl(mEpollFd, EPOLL_CTL_DEL, aFd, NULL);
+}
+
+int
+WifiIpcManager::writeToIpc(uint32_t aConnId, uint8_t* aData, size_t aDataLen)
+{
+  std::map<uint32_t, WifiIpcConnection*>::iterator it;
+
   if (aData == NULL) {
     return -1;
   }
 
-  return mIpcHandler->writeIpc(aData, aDataLen);
-}
\ No newline at end of file
+  it = mConnections.find(aConnId);
+  if (it == mConnections.end()) {
+    WIFID_WARNING("Connection %u is gone, drop the message.", aConnId);
+    return -1;
+  }
+
+  return it->second->write(aData, aDataLen);
+}
+
+int
+WifiIpcManager::writeToIpc(uint32_t aConnId, const struct iovec* aIov, int aIovCnt)
+{
+  std::map<uint32_t, WifiIpcConnection*>::iterator it;
+
+  if (aIov == NULL) {
+    return -1;
+  }
+
+  it = mConnections.find(aConnId);
+  if (it == mConnections.end()) {
+    WIFID_WARNING("Connection %u is gone, drop the message.", aConnId);
+    return -1;
+  }
+
+  return it->second->write(aIov, aIovCnt);
+}
+
+int
+WifiIpcManager::streamToIpc(uint32_t aConnId, WifiOutStream* aStream)
+{
+  std::map<uint32_t, WifiIpcConnection*>::iterator it;
+
+  if (aStream == NULL) {
+    return -1;
+  }
+
+  it = mConnections.find(aConnId);
+  if (it == mConnections.end()) {
+    WIFID_WARNING("Connection %u is gone, drop the stream.", aConnId);
+    delete aStream;
+    return -1;
+  }
+
+  return it->second->writeStream(aStream);
+}
+
+int
+WifiIpcManager::upgradeToShm(uint32_t aConnId, const uint8_t* aFrame,
+  size_t aLength)
+{
+  std::map<uint32_t, WifiIpcConnection*>::iterator it;
+
+  it = mConnections.find(aConnId);
+  if (it == mConnections.end()) {
+    return -1;
+  }
+
+  return it->second->upgradeToShm(aFrame, aLength);
+}
+
+int
+WifiIpcManager::broadcastToSubscribers(uint32_t aEventMask,
+  const struct iovec* aIov, int aIovCnt)
+{
+  std::map<uint32_t, WifiIpcConnection*>::iterator it;
+  int ret = 0;
+
+  if (aIov == NULL) {
+    return -1;
+  }
+
+  for (it = mConnections.begin(); it != mConnections.end(); ++it) {
+    if (it->second->getEventMask() == aEventMask &&
+        it->second->write(aIov, aIovCnt) < 0) {
+      ret = -1;
+    }
+  }
+
+  return ret;
+}
+
+int
+WifiIpcManager::setEventMask(uint32_t aConnId, uint32_t aEventMask)
+{
+  std::map<uint32_t, WifiIpcConnection*>::iterator it;
+
+  it = mConnections.find(aConnId);
+  if (it == mConnections.end()) {
+    return -1;
+  }
+
+  it->second->setEventMask(aEventMask);
+
+  return 0;
+}
+
+void
+WifiIpcManager::getEventMasks(std::vector<uint32_t>* aMasks)
+{
+  std::map<uint32_t, WifiIpcConnection*>::iterator it;
+
+  aMasks->clear();
+
+  // Peers are few and usually share one mask.
+  for (it = mConnections.begin(); it != mConnections.end(); ++it) {
+    uint32_t mask = it->second->getEventMask();
+
+    if (std::find(aMasks->begin(), aMasks->end(), mask) == aMasks->end()) {
+      aMasks->push_back(mask);
+    }
+  }
+}
@@ -18,30 +18,125 @@
 #define WifiIpcManager_h
 
 #include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
 
 #include "IpcHandler.h"
+#include "WifiIpcLifecycle.h"
 
+class WifiIpcConnection;
 class WifiMessageHandler;
+class WifiOutStream;
 
+/**
+ * Receives the events of a descriptor registered in the epoll reactor.
+ */
+class WifiPollListener
+{
+public:
+  virtual void onPollEvent(uint32_t aEvents) = 0;
+
+  virtual ~WifiPollListener() {}
+};
+
+/**
+ * Called back once a timer set with WifiIpcManager::setTimer() expires.
+ */
+class WifiTimerListener
+{
+public:
+  virtual void onTimer() = 0;
+
+  virtual ~WifiTimerListener() {}
+};
+
+/**
+ * Runs the epoll reactor of the daemon on the thread calling loop().
+ *
+ * The socket to the peer is opened from a timer: a failed open is retried
+ * with the backoff of WifiIpcLifecycle while the reactor keeps serving
+ * its other descriptors, so waiting for the peer costs no CPU.
+ */
 class WifiIpcManager
+  : public WifiPollListener
+  , public WifiTimerListener
 {
 private:
   static WifiIpcManager* sInstance;
 
 public:
+  static const int MAX_EVENTS = 16;
+  static const size_t MAX_CONNECTIONS = 16;
+
   ~WifiIpcManager();
 
   static WifiIpcManager* Instance();
 
   void init(IpcHandler* aIpcHandler, WifiMessageHandler* aMsgHandler);
   void loop();
-  int writeToIpc(uint8_t* aData, size_t aDataLen);
+  int writeToIpc(uint32_t aConnId, uint8_t* aData, size_t aDataLen);
+  int writeToIpc(uint32_t aConnId, const struct iovec* aIov, int aIovCnt);
+  // Sends to the connections subscribed to exactly the events of aEventMask.
+  int broadcastToSubscribers(uint32_t aEventMask, const struct iovec* aIov,
+                             int aIovCnt);
+  int setEventMask(uint32_t aConnId, uint32_t aEventMask);
+  // Lists the distinct event masks of the connections.
+  void getEventMasks(std::vector<uint32_t>* aMasks);
+  // Takes the ownership of aStream.
+  int streamToIpc(uint32_t aConnId, WifiOutStream* aStream);
+  // Sends the handshake response aFrame and moves the connection over to
+  // shared memory, see WifiIpcConnection::upgradeToShm().
+  int upgradeToShm(uint32_t aConnId, const uint8_t* aFrame, size_t aLength);
+
+  // Calls aListener->onTimer() once on the loop thread, aDelayUs from
+  // now. Setting the timer of a listener again moves it.
+  void setTimer(WifiTimerListener* aListener, uint64_t aDelayUs);
+  void cancelTimer(WifiTimerListener* aListener);
+
+  // Retries to open the socket now instead of after the backoff, for
+  // when the peer is known to be back.
+  void reconnectNow();
+  // Calls reconnectNow() whenever aSignal is received. The signal must
+  // be blocked in every thread.
+  int watchReconnectSignal(int aSignal);
+  // Appends a one line report of the connection lifecycle.
+  void reportLifecycle(std::string* aOut);
+  // Appends one line per connection on its outbound queue.
+  void reportQueues(std::string* aOut);
+
+  int addPollFd(int aFd, uint32_t aEvents, WifiPollListener* aListener);
+  int modifyPollFd(int aFd, uint32_t aEvents, WifiPollListener* aListener);
+  int removePollFd(int aFd);
+
+  void closeConnection(WifiIpcConnection* aConn);
+
+  // Accepts new peers on the listening socket.
+  void onPollEvent(uint32_t aEvents);
+
+  // Opens the socket.
+  void onTimer();
 
 private:
   WifiIpcManager();
 
+  void connect();
+  void disconnect();
+  int getTimeout();
+  void runTimers();
+
+  WifiIpcConnection* openConnection(IpcHandler* aIpcHandler, bool aOwnsHandler);
+  void closeAllConnections();
+  void reapConnections();
+
   IpcHandler*     mIpcHandler;
   WifiMessageHandler* mMsgHandler;
+  int mEpollFd;
+  uint32_t mNextConnId;
+  std::map<uint32_t, WifiIpcConnection*> mConnections;
+  std::vector<WifiIpcConnection*> mClosedConnections;
+  std::map<WifiTimerListener*, uint64_t> mTimers;   // deadlines
+  WifiIpcLifecycle mLifecycle;
 };
 
-#endif // WifiIpcManager_h
\ No newline at end of file
+#endif // WifiIpcManager_h
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <hardware_legacy/wifi.h>
+
+#include "WifiDebug.h"
+#include "WifiLegacyHal.h"
+
+WifiLegacyHal::WifiLegacyHal()
+{
+  pthread_mutex_init(&mLock, NULL);
+}
+
+WifiLegacyHal::~WifiLegacyHal()
+{
+  pthread_mutex_destroy(&mLock);
+}
+
+int
+WifiLegacyHal::loadDriver()
+{
+  int ret;
+
+  pthread_mutex_lock(&mLock);
+  ret = wifi_load_driver();
+  pthread_mutex_unlock(&mLock);
+
+  return ret;
+}
+
+int
+WifiLegacyHal::unloadDriver()
+{
+  int ret;
+
+  pthread_mutex_lock(&mLock);
+  ret = wifi_unload_driver();
+  pthread_mutex_unlock(&mLock);
+
+  return ret;
+}
+
+int
+WifiLegacyHal::startSupplicant(bool aP2pSupported)
+{
+  int ret;
+
+  pthread_mutex_lock(&mLock);
+  ret = wifi_start_supplicant(aP2pSupported ? 1 : 0);
+  pthread_mutex_unlock(&mLock);
+
+  return ret;
+}
+
+int
+WifiLegacyHal::stopSupplicant(bool aP2pSupported)
+{
+  int ret;
+
+  pthread_mutex_lock(&mLock);
+  ret = wifi_stop_supplicant(aP2pSupported ? 1 : 0);
+  pthread_mutex_unlock(&mLock);
+
+  return ret;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiLegacyHal_h
+#define WifiLegacyHal_h
+
+#include <pthread.h>
+
+#include "WifiHal.h"
+
+/**
+ * WifiHal on top of libhardware_legacy. The legacy functions are not
+ * reentrant, so calls from different workers are serialized.
+ */
+class WifiLegacyHal :
+  public WifiHal
+{
+public:
+  WifiLegacyHal();
+  ~WifiLegacyHal();
+
+  int loadDriver();
+  int unloadDriver();
+  int startSupplicant(bool aP2pSupported);
+  int stopSupplicant(bool aP2pSupported);
+
+private:
+  pthread_mutex_t mLock;
+};
+
+#endif // WifiLegacyHal_h
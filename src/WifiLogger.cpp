@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "utils/Log.h"
+#include "WifiLogger.h"
+
+#define TAG_LOGGER "wifid"
+
+WifiLogger* WifiLogger::sInstance = NULL;
+
+WifiLogger*
+WifiLogger::Instance()
+{
+  if (!sInstance) {
+    sInstance = new WifiLogger();
+  }
+  return sInstance;
+}
+
+WifiLogger::WifiLogger()
+  : mHead(0)
+  , mTail(0)
+  , mDropped(0)
+  , mSleeping(0)
+  , mRunning(false)
+{
+  // A slot is free for the producer at position seq, and published to
+  // the drain thread at seq + 1.
+  for (uint32_t i = 0; i < RING_SIZE; i++) {
+    mRing[i].seq = i;
+  }
+}
+
+WifiLogger::~WifiLogger()
+{
+  stop();
+}
+
+int
+WifiLogger::start()
+{
+  if (mRunning) {
+    return 0;
+  }
+
+  mRunning = true;
+  if (pthread_create(&mThread, NULL, threadMain, this)) {
+    mRunning = false;
+    __android_log_print(ANDROID_LOG_ERROR, TAG_LOGGER,
+      "Could not create the logging thread, log synchronously.");
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+WifiLogger::stop()
+{
+  if (!mRunning) {
+    return;
+  }
+
+  mRunning = false;
+  __sync_synchronize();
+  wake();
+  pthread_join(mThread, NULL);
+
+  // Records published while the thread was exiting.
+  drain();
+}
+
+void
+WifiLogger::log(int aLevel, const char* aTag, const char* aFunc,
+  const char* aFmt, ...)
+{
+  va_list args;
+  Record* rec;
+  uint32_t pos;
+  int32_t diff;
+  int len;
+
+  if (!mRunning) {
+    char text[TEXT_SIZE];
+
+    va_start(args, aFmt);
+    vsnprintf(text, sizeof(text), aFmt, args);
+    va_end(args);
+
+    __android_log_print(aLevel, aTag, "%s: %s", aFunc, text);
+    return;
+  }
+
+  // Claim a slot, Vyukov's bounded queue.
+  pos = mHead;
+  while (1) {
+    rec = &mRing[pos & (RING_SIZE - 1)];
+    diff = static_cast<int32_t>(rec->seq - pos);
+
+    if (diff == 0) {
+      if (__sync_bool_compare_and_swap(&mHead, pos, pos + 1)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // The drain thread is a whole ring behind.
+      __sync_fetch_and_add(&mDropped, 1);
+      return;
+    }
+
+    pos = mHead;
+  }
+
+  // The arguments may point to transient buffers, they are formatted
+  // right away. The prefix and the write are left to the drain thread.
+  va_start(args, aFmt);
+  len = vsnprintf(rec->text, TEXT_SIZE, aFmt, args);
+  va_end(args);
+
+  rec->level = aLevel;
+  rec->length = len < 0 ? 0 : (len < static_cast<int>(TEXT_SIZE) ? len : TEXT_SIZE - 1);
+  rec->tag = aTag;
+  rec->func = aFunc;
+
+  __sync_synchronize();
+  rec->seq = pos + 1;
+
+  // Pairs with the barrier of the drain thread going to sleep.
+  __sync_synchronize();
+  if (mSleeping) {
+    wake();
+  }
+}
+
+void
+WifiLogger::wake()
+{
+  if (__sync_bool_compare_and_swap(&mSleeping, 1, 0)) {
+    syscall(__NR_futex, &mSleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+void*
+WifiLogger::threadMain(void* aArg)
+{
+  static_cast<WifiLogger*>(aArg)->drainLoop();
+
+  return NULL;
+}
+
+void
+WifiLogger::drainLoop()
+{
+  uint32_t dropped;
+
+  while (mRunning) {
+    if (drain() == 0) {
+      // Announce the sleep before the last look at the ring, a record
+      // published after it sees the flag and wakes us.
+      mSleeping = 1;
+      __sync_synchronize();
+      if (drain() == 0 && mRunning) {
+        syscall(__NR_futex, &mSleeping, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+      }
+      mSleeping = 0;
+    }
+
+    dropped = __sync_lock_test_and_set(&mDropped, 0);
+    if (dropped) {
+      __android_log_print(ANDROID_LOG_WARN, TAG_LOGGER,
+        "%u log messages dropped, the log ring was full.", dropped);
+    }
+  }
+}
+
+int
+WifiLogger::drain()
+{
+  Record* rec;
+  int count = 0;
+
+  while (1) {
+    rec = &mRing[mTail & (RING_SIZE - 1)];
+
+    if (rec->seq != mTail + 1) {
+      // Empty, or the next record is still being written.
+      break;
+    }
+
+    __sync_synchronize();
+    __android_log_print(rec->level, rec->tag, "%s: %.*s", rec->func,
+      rec->length, rec->text);
+
+    // Hand the slot back for the next lap of the ring.
+    __sync_synchronize();
+    rec->seq = mTail + RING_SIZE;
+    mTail++;
+    count++;
+  }
+
+  return count;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiLogger_h
+#define WifiLogger_h
+
+#include <pthread.h>
+#include <stdint.h>
+
+/**
+ * Asynchronous logger behind the WIFID_* macros.
+ *
+ * Any thread appends a record to a bounded lock-free ring, a slot claimed
+ * with one compare-and-swap, and returns. A background thread drains the
+ * ring into the android log, so no log syscall happens on the caller's
+ * thread. When the ring is full the record is dropped and counted rather
+ * than blocking the caller. Until start() is called, and after stop(),
+ * messages are written synchronously.
+ *
+ * The drain thread sleeps on a futex while the ring is empty. Only the
+ * producer that finds it asleep makes the syscall waking it.
+ *
+ * Instance() must first be called before any other thread logs.
+ */
+class WifiLogger
+{
+private:
+  static WifiLogger* sInstance;
+
+public:
+  static const uint32_t RING_SIZE = 512;    // power of two
+  static const uint32_t TEXT_SIZE = 224;
+
+  ~WifiLogger();
+
+  static WifiLogger* Instance();
+
+  int start();
+  void stop();
+
+  void log(int aLevel, const char* aTag, const char* aFunc,
+           const char* aFmt, ...) __attribute__((format(printf, 5, 6)));
+
+private:
+  WifiLogger();
+
+  struct Record {
+    volatile uint32_t seq;
+    uint16_t level;
+    uint16_t length;
+    const char* tag;
+    const char* func;
+    char text[TEXT_SIZE];
+  };
+
+  static void* threadMain(void* aArg);
+
+  void drainLoop();
+  // Writes out every published record, returns how many.
+  int drain();
+  void wake();
+
+  Record mRing[RING_SIZE];
+  // Next slot to claim by producers, and to read by the drain thread.
+  volatile uint32_t mHead;
+  uint32_t mTail;
+  volatile uint32_t mDropped;
+  // Futex word, 1 while the drain thread sleeps or is about to.
+  volatile int32_t mSleeping;
+
+  pthread_t mThread;
+  volatile bool mRunning;
+};
+
+#endif // WifiLogger_h
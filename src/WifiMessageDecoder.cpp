@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "WifiDebug.h"
+#include "WifiGonkMessage.h"
+#include "WifiMessageDecoder.h"
+
+WifiMessageDecoder::WifiMessageDecoder()
+  : mBuf(NULL)
+  , mCapacity(0)
+  , mStart(0)
+  , mEnd(0)
+{
+}
+
+WifiMessageDecoder::~WifiMessageDecoder()
+{
+  free(mBuf);
+}
+
+bool
+WifiMessageDecoder::reserve(size_t aCapacity)
+{
+  uint8_t* buf;
+
+  if (aCapacity <= mCapacity) {
+    return true;
+  }
+
+  buf = static_cast<uint8_t*>(realloc(mBuf, aCapacity));
+  if (!buf) {
+    WIFID_ERROR("Could not grow the receive buffer to %zu bytes.", aCapacity);
+    return false;
+  }
+
+  mBuf = buf;
+  mCapacity = aCapacity;
+
+  return true;
+}
+
+uint8_t*
+WifiMessageDecoder::getWriteBuffer(size_t* aSpace, size_t aMinSpace)
+{
+  size_t pending = mEnd - mStart;
+  size_t capacity = DEFAULT_BUFSIZE;
+
+  assert(aSpace);
+
+  // Make room for the whole message if its header is already here.
+  if (pending >= sizeof(struct WifiMsgHeader)) {
+    const struct WifiMsgHeader* hdr =
+      reinterpret_cast<const struct WifiMsgHeader*>(mBuf + mStart);
+    size_t frameLen = sizeof(struct WifiMsgHeader) + hdr->len;
+
+    if (frameLen > capacity && frameLen <= MAX_MESSAGE_SIZE) {
+      capacity = frameLen;
+    }
+  }
+
+  if (pending + aMinSpace > capacity) {
+    capacity = pending + aMinSpace < MAX_MESSAGE_SIZE ?
+      pending + aMinSpace : MAX_MESSAGE_SIZE;
+  }
+
+  if (pending == 0 && mCapacity > DEFAULT_BUFSIZE) {
+    // Give back the memory of a previous large message.
+    free(mBuf);
+    mBuf = NULL;
+    mCapacity = 0;
+  }
+
+  // Move the partial message to the front of the buffer.
+  if (mStart > 0) {
+    memmove(mBuf, mBuf + mStart, pending);
+    mStart = 0;
+    mEnd = pending;
+  }
+
+  if (!reserve(capacity)) {
+    *aSpace = 0;
+    return NULL;
+  }
+
+  *aSpace = mCapacity - mEnd;
+
+  return mBuf + mEnd;
+}
+
+void
+WifiMessageDecoder::commit(size_t aLength)
+{
+  assert(mEnd + aLength <= mCapacity);
+
+  mEnd += aLength;
+}
+
+int
+WifiMessageDecoder::nextMessage(uint8_t** aData, size_t* aDataLen)
+{
+  size_t pending = mEnd - mStart;
+  size_t frameLen;
+  const struct WifiMsgHeader* hdr;
+
+  assert(aData);
+  assert(aDataLen);
+
+  if (pending < sizeof(struct WifiMsgHeader)) {
+    return 0;
+  }
+
+  hdr = reinterpret_cast<const struct WifiMsgHeader*>(mBuf + mStart);
+
+  if (hdr->len > MAX_MESSAGE_SIZE - sizeof(struct WifiMsgHeader)) {
+    WIFID_ERROR("Message length(%u) exceeds the limit.", hdr->len);
+    return -1;
+  }
+
+  frameLen = sizeof(struct WifiMsgHeader) + hdr->len;
+
+  if (pending < frameLen) {
+    return 0;
+  }
+
+  *aData = mBuf + mStart;
+  *aDataLen = frameLen;
+  mStart += frameLen;
+
+  if (mStart == mEnd) {
+    mStart = mEnd = 0;
+  }
+
+  return 1;
+}
+
+void
+WifiMessageDecoder::reset()
+{
+  mStart = mEnd = 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiMessageDecoder_h
+#define WifiMessageDecoder_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Incremental decoder splitting a byte stream into wifi daemon messages.
+ *
+ * The frame length is taken from WifiMsgHeader.len, which excludes the
+ * 8 bytes of header. Data is read straight into the decoder's buffer, so
+ * several back-to-back messages can be pulled out of a single read and a
+ * message split across reads is reassembled in place. The buffer grows
+ * up to MAX_MESSAGE_SIZE for large payloads and shrinks back once idle.
+ */
+class WifiMessageDecoder
+{
+public:
+  static const size_t DEFAULT_BUFSIZE = 4096;
+  static const size_t MAX_MESSAGE_SIZE = 256 * 1024;
+
+  WifiMessageDecoder();
+  ~WifiMessageDecoder();
+
+  // Returns the free space at the tail of the buffer to read into. The
+  // space is large enough for the rest of a partially received message,
+  // and for aMinSpace bytes up to MAX_MESSAGE_SIZE, such as a whole packet.
+  uint8_t* getWriteBuffer(size_t* aSpace, size_t aMinSpace = 0);
+
+  // Marks aLength bytes of the write buffer as received.
+  void commit(size_t aLength);
+
+  // Returns 1 and the next complete message, 0 if more data is needed, or
+  // -1 if the stream is corrupted. The message stays valid until the next
+  // call of getWriteBuffer() or reset().
+  int nextMessage(uint8_t** aData, size_t* aDataLen);
+
+  void reset();
+
+private:
+  bool reserve(size_t aCapacity);
+
+  uint8_t* mBuf;
+  size_t mCapacity;
+  size_t mStart;
+  size_t mEnd;
+};
+
+#endif // WifiMessageDecoder_h
@@ -15,16 +15,129 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
+#include "WifiBufferPool.h"
 #include "WifiDebug.h"
+#include "WifiEventFilter.h"
 #include "WifiMessageHandler.h"
+#include "WifiResponseStream.h"
+#include "WifiShmIpcHandler.h"
+#include "WifiSupplicantCtrl.h"
+#include "WifiSupplicantMonitor.h"
 
 #define MAJOR_VER 1
-#define MINOR_VER 0
+#define MINOR_VER 7
+
+#define SCAN_RESULTS_EVENT "CTRL-EVENT-SCAN-RESULTS"
+
+/**
+ * Runs one supplicant operation off the loop thread and answers its
+ * request once done. Driver operations go through WifiDriverState.
+ */
+class WifiHalTask
+  : public WifiTask
+{
+public:
+  WifiHalTask(WifiHal* aHal, WifiMessageHandler* aMsgHandler,
+              WifiRequestId aId, WifiMessageType aType, bool aP2pSupported)
+    : mHal(aHal)
+    , mMsgHandler(aMsgHandler)
+    , mId(aId)
+    , mType(aType)
+    , mP2pSupported(aP2pSupported)
+    , mResult(-1)
+  {
+  }
+
+  void run()
+  {
+    switch (mType) {
+      case WIFI_MESSAGE_TYPE_START_SUPPLICANT:
+        mResult = mHal->startSupplicant(mP2pSupported);
+        break;
+
+      case WIFI_MESSAGE_TYPE_STOP_SUPPLICANT:
+        mResult = mHal->stopSupplicant(mP2pSupported);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  void complete()
+  {
+    mMsgHandler->processResponse(mId, mType,
+      mResult < 0 ? WIFI_STATUS_ERROR : WIFI_STATUS_OK, NULL, 0);
+  }
+
+private:
+  WifiHal* mHal;
+  WifiMessageHandler* mMsgHandler;
+  WifiRequestId mId;
+  WifiMessageType mType;
+  bool mP2pSupported;
+  int mResult;
+};
+
+/**
+ * Dumps the statistics of the daemon when a signal arrives, read from a
+ * signalfd on the loop thread.
+ */
+class WifiStatsSignal
+  : public WifiPollListener
+{
+public:
+  WifiStatsSignal(WifiMessageHandler* aMsgHandler, int aFd)
+    : mMsgHandler(aMsgHandler)
+    , mFd(aFd)
+  {
+  }
+
+  void onPollEvent(uint32_t aEvents)
+  {
+    struct signalfd_siginfo info;
+
+    while (TEMP_FAILURE_RETRY(read(mFd, &info, sizeof(info))) == sizeof(info)) {
+      mMsgHandler->dumpStats();
+    }
+  }
+
+private:
+  WifiMessageHandler* mMsgHandler;
+  int mFd;
+};
+
+#define WIFI_MESSAGE_SCHEMA_ENTRY(type, req, resp, priority, handler)  \
+  { WifiPayloadTraits<struct req>::minLength,               \
+    WifiPayloadTraits<struct resp>::minLength,              \
+    WifiPayloadTraits<struct resp>::hasData,                \
+    WIFI_PRIORITY_##priority,                               \
+    &WifiMessageHandler::handler },
+
+const WifiMessageHandler::MessageSchema
+WifiMessageHandler::sSchema[WIFI_MESSAGE_NUM_TYPES] = {
+  WIFI_MESSAGE_SCHEMA(WIFI_MESSAGE_SCHEMA_ENTRY)
+};
 
 WifiMessageHandler::WifiMessageHandler()
   : mIpcMgr(NULL)
+  , mHal(NULL)
+  , mWorkerPool(NULL)
+  , mSuppCtrl(NULL)
+  , mSuppMonitor(NULL)
+  , mDriver(this)
+  , mBringUp(this, &mDriver)
+  , mEventCoalescer(this)
+  , mRunningQueued(false)
+  , mScanFillId(WIFI_REQUEST_ID_INVALID)
+  , mScanFillGeneration(0)
 {
 }
 
@@ -38,18 +151,61 @@ WifiMessageHandler::setIpcManager(WifiIpcManager* aIpcMgr)
   assert(aIpcMgr);
 
   mIpcMgr = aIpcMgr;
+  mDriver.setIpcManager(aIpcMgr);
+  mBringUp.setIpcManager(aIpcMgr);
+  mEventCoalescer.setIpcManager(aIpcMgr);
+}
+
+void
+WifiMessageHandler::setSupplicantCtrl(WifiSupplicantCtrl* aSuppCtrl,
+  WifiSupplicantMonitor* aSuppMonitor)
+{
+  assert(aSuppCtrl);
+  assert(aSuppMonitor);
+
+  mSuppCtrl = aSuppCtrl;
+  mSuppMonitor = aSuppMonitor;
+}
+
+void
+WifiMessageHandler::setHal(WifiHal* aHal, WifiWorkerPool* aWorkerPool)
+{
+  assert(aHal);
+  assert(aWorkerPool);
+
+  mHal = aHal;
+  mWorkerPool = aWorkerPool;
+  mDriver.setHal(aHal, aWorkerPool);
+  mBringUp.setHal(aHal, aWorkerPool);
+}
+
+void
+WifiMessageHandler::setDriverUnloadDelay(uint64_t aDelayUs)
+{
+  mDriver.setUnloadDelay(aDelayUs);
+}
+
+void
+WifiMessageHandler::setEventWindow(uint64_t aWindowUs, size_t aMaxEvents)
+{
+  mEventCoalescer.setWindow(aWindowUs, aMaxEvents);
 }
 
 int
-WifiMessageHandler::processMsg(uint8_t* aData, size_t aDataLen)
+WifiMessageHandler::processMsg(uint32_t aConnId, uint8_t* aData, size_t aDataLen)
 {
   assert(aData);
 
   uint16_t msgCategory;
-  uint16_t msgType;
-  uint16_t sessionId;
+  WifiPriority priority;
+  WifiMessageView<struct WifiMsgReq> req(aData, aDataLen);
 
-  msgCategory = WIFI_MSG_GET_CATEGORY(aData);
+  if (aDataLen < sizeof(struct WifiMsgHeader)) {
+    WIFID_ERROR("Message is shorter than its header.");
+    return -1;
+  }
+
+  msgCategory = req->hdr.msgCategory;
 
   if (msgCategory != WIFI_MESSAGE_REQUEST) {
     WIFID_WARNING("The wifi daemon only process request message. Message: %d.",
@@ -57,52 +213,146 @@ WifiMessageHandler::processMsg(uint8_t* aData, size_t aDataLen)
     return 0;
   }
 
-  msgType = WIFI_MSG_GET_TYPE(aData);
-  sessionId = WIFI_MSG_GET_REQ_SESSION_ID(aData);
+  if (!req.isValid()) {
+    WIFID_ERROR("Request of %zu bytes is truncated.", aDataLen);
+    return -1;
+  }
+
+  priority = getPriority(req->hdr.msgType);
+
+  // Control requests run now, the others may have to wait for a place.
+  if (!mScheduler.admit(priority)) {
+    if (mScheduler.enqueue(priority, aConnId, aData,
+          sizeof(struct WifiMsgHeader) + req->hdr.len) < 0) {
+      WIFID_WARNING("Too many requests waiting, reject session %u.",
+        req->sessionId);
+      mStats.onRequest(aConnId, req->hdr.msgType, aDataLen);
+      mStats.onResponse(aConnId, req->hdr.msgType, true,
+        sizeof(struct WifiMsgResp), WifiStats::getTime());
+      return sendResponse(aConnId, req->sessionId, req->hdr.msgType,
+        WIFI_STATUS_ERROR, NULL, 0);
+    }
+    return 0;
+  }
+
+  return dispatch(aConnId, req, WIFI_REQUEST_ID_INVALID);
+}
 
-  // Insert session id into session map according to the message type.
-  mSessionMap[msgType].push(sessionId);
+WifiPriority
+WifiMessageHandler::getPriority(uint16_t aMsgType)
+{
+  // Unknown types are answered at once.
+  return aMsgType < WIFI_MESSAGE_NUM_TYPES ? sSchema[aMsgType].priority :
+                                             WIFI_PRIORITY_INTERACTIVE;
+}
 
-  switch (msgType) {
-    case WIFI_MESSAGE_TYPE_VERSION:
-      handleMessageVersion();
-      break;
+// Runs one valid request, on its own or as part of the batch aBatchId.
+int
+WifiMessageHandler::dispatch(uint32_t aConnId,
+  const WifiMessageView<struct WifiMsgReq>& aReq, WifiRequestId aBatchId)
+{
+  uint16_t msgType = aReq->hdr.msgType;
+  uint16_t sessionId = aReq->sessionId;
+  size_t length = sizeof(struct WifiMsgHeader) + aReq->hdr.len;
+  WifiRequestId id;
+  const MessageSchema* schema;
 
-    case WIFI_MESSAGE_TYPE_LOAD_DRIVER:
-      break;
+  mStats.onRequest(aConnId, msgType, length);
 
-    case WIFI_MESSAGE_TYPE_UNLOAD_DRIVER:
-      break;
+  // The batch was admitted for all its requests.
+  if (aBatchId != WIFI_REQUEST_ID_INVALID) {
+    mScheduler.charge(getPriority(msgType));
+  }
 
-    case WIFI_MESSAGE_TYPE_START_SUPPLICANT:
-      break;
+  // Track the request until its response is sent.
+  id = mRequests.add(aConnId, sessionId, msgType);
 
-    case WIFI_MESSAGE_TYPE_STOP_SUPPLICANT:
-      break;
+  if (id == WIFI_REQUEST_ID_INVALID) {
+    WIFID_WARNING("Too many requests in flight, reject session %u.", sessionId);
+    mStats.onResponse(aConnId, msgType, true, sizeof(struct WifiMsgResp),
+      WifiStats::getTime());
+    mScheduler.done(getPriority(msgType));
+    if (aBatchId != WIFI_REQUEST_ID_INVALID) {
+      return addToBatch(aBatchId, sessionId, msgType, WIFI_STATUS_ERROR, NULL, 0);
+    }
+    return sendResponse(aConnId, sessionId, msgType, WIFI_STATUS_ERROR, NULL, 0);
+  }
 
-    case WIFI_MESSAGE_TYPE_CONNECT_TO_SUPPLICANT:
-      break;
+  mRequests.get(id)->batchId = aBatchId;
 
-    case WIFI_MESSAGE_TYPE_CLOSE_SUPPLICANT_CONNECTION:
-      break;
+  if (msgType >= WIFI_MESSAGE_NUM_TYPES) {
+    WIFID_WARNING("Request Type(%d) does not support.", msgType);
+    respondStatus(id, WIFI_STATUS_ERROR);
+    return 0;
+  }
 
-    case WIFI_MESSAGE_TYPE_COMMAND:
-      break;
+  // Neither fits in the response of a batch.
+  if (aBatchId != WIFI_REQUEST_ID_INVALID &&
+      (msgType == WIFI_MESSAGE_TYPE_BATCH ||
+       msgType == WIFI_MESSAGE_TYPE_SHM_TRANSPORT)) {
+    WIFID_WARNING("Request Type(%d) is not allowed in a batch.", msgType);
+    respondStatus(id, WIFI_STATUS_ERROR);
+    return 0;
+  }
 
-    default:
-      break;
+  schema = &sSchema[msgType];
+
+  if (aReq.getBodyLength() < schema->requestLength) {
+    WIFID_ERROR("Request Type(%d) misses its payload.", msgType);
+    respondStatus(id, WIFI_STATUS_ERROR);
+    return 0;
   }
 
+  (this->*schema->handler)(id, aReq.getBody(), aReq.getBodyLength());
+
   return 0;
 }
 
+// Forgets a request once answered and lets a waiting one take its place.
+void
+WifiMessageHandler::finishRequest(WifiRequestId aId)
+{
+  struct WifiRequest* req = mRequests.get(aId);
+
+  assert(req);
+
+  mScheduler.done(getPriority(req->msgType));
+  mRequests.remove(aId);
+
+  runQueued();
+}
+
+void
+WifiMessageHandler::runQueued()
+{
+  uint32_t connId;
+  std::string data;
+
+  // Requests answered right away finish inside the loop below.
+  if (mRunningQueued) {
+    return;
+  }
+  mRunningQueued = true;
+
+  while (mScheduler.next(&connId, &data)) {
+    WifiMessageView<struct WifiMsgReq> req(
+      reinterpret_cast<const uint8_t*>(data.data()), data.size());
+
+    dispatch(connId, req, WIFI_REQUEST_ID_INVALID);
+  }
+
+  mRunningQueued = false;
+}
+
 void
 WifiMessageHandler::processNotification(WifiNotificationType aType,
   void* aData, size_t aLength)
 {
   switch (aType) {
     case WIFI_NOTIFICATION_EVENT:
-        sendNotificationEvent(aData, aLength);
+        // The caches can not wait for the window.
+        invalidateOnEvents(static_cast<const char*>(aData), aLength);
+        mEventCoalescer.add(static_cast<const char*>(aData), aLength);
       break;
 
     default:
@@ -113,113 +363,747 @@ WifiMessageHandler::processNotification(WifiNotificationType aType,
 
 void
 WifiMessageHandler::processResponse(
+  WifiRequestId aId,
   WifiMessageType aType,
   WifiStatusCode aStatus,
   void* aData,
   size_t aLength)
 {
-  switch (aType) {
+  struct WifiRequest* req = mRequests.get(aId);
 
-    case WIFI_MESSAGE_TYPE_LOAD_DRIVER:
-      respondStatus(WIFI_MESSAGE_TYPE_LOAD_DRIVER, aStatus);
-      break;
+  // The table is refilled even if the client went away meanwhile.
+  if (aId == mScanFillId) {
+    mScanFillId = WIFI_REQUEST_ID_INVALID;
+    if (aStatus == WIFI_STATUS_OK) {
+      mScanResults.fill(mScanFillGeneration, mScanFillCmd.data(),
+        mScanFillCmd.size(), static_cast<const char*>(aData), aLength);
+    }
+  }
 
-    case WIFI_MESSAGE_TYPE_UNLOAD_DRIVER:
-      respondStatus(WIFI_MESSAGE_TYPE_UNLOAD_DRIVER, aStatus);
-      break;
+  if (aType == WIFI_MESSAGE_TYPE_COMMAND) {
+    mCommandCache.fill(aId, aStatus == WIFI_STATUS_OK,
+      static_cast<const char*>(aData), aLength);
+    answerFollowers(aId, aStatus, aData, aLength);
+  }
 
-    case WIFI_MESSAGE_TYPE_START_SUPPLICANT:
-      respondStatus(WIFI_MESSAGE_TYPE_START_SUPPLICANT, aStatus);
-      break;
+  if (!req) {
+    // The client went away while the request was in flight.
+    WIFID_DEBUG("Response Type(%d) has no pending request.", aType);
+    return;
+  }
 
-    case WIFI_MESSAGE_TYPE_STOP_SUPPLICANT:
-      respondStatus(WIFI_MESSAGE_TYPE_STOP_SUPPLICANT, aStatus);
-      break;
+  assert(req->msgType == aType);
+  assert(aType < WIFI_MESSAGE_NUM_TYPES);
 
-    case WIFI_MESSAGE_TYPE_CONNECT_TO_SUPPLICANT:
-      respondStatus(WIFI_MESSAGE_TYPE_CONNECT_TO_SUPPLICANT, aStatus);
-      break;
+  if (sSchema[aType].hasResponseData) {
+    respond(aId, aStatus, aData, aLength);
+  } else {
+    respondStatus(aId, aStatus);
+  }
+}
 
-    case WIFI_MESSAGE_TYPE_CLOSE_SUPPLICANT_CONNECTION:
-      respondStatus(WIFI_MESSAGE_TYPE_CLOSE_SUPPLICANT_CONNECTION, aStatus);
-      break;
+void
+WifiMessageHandler::removeConnection(uint32_t aConnId)
+{
+  std::map<WifiRequestId, Batch>::iterator it = mBatches.begin();
+  struct WifiRequest* req;
 
-    case WIFI_MESSAGE_TYPE_COMMAND:
-      respondStatus(WIFI_MESSAGE_TYPE_COMMAND, aStatus);
-      break;
+  // Give the places of its requests back.
+  for (size_t i = 0; i < WifiRequestTable::MAX_REQUESTS; i++) {
+    req = mRequests.getAt(i);
+    if (req && req->connId == aConnId) {
+      mScheduler.done(getPriority(req->msgType));
+    }
+  }
 
-    default:
-      WIFID_ERROR("Response Type(%d) does not support.", aType);
-      break;
+  mRequests.removeConnection(aConnId);
+  mStats.removeConnection(aConnId);
+  mScheduler.removeConnection(aConnId);
+
+  while (it != mBatches.end()) {
+    if (!mRequests.get(it->first)) {
+      mBatches.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  runQueued();
+}
+
+int
+WifiMessageHandler::watchStatsSignal(int aSignal)
+{
+  sigset_t mask;
+  int fd;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, aSignal);
+
+  fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    WIFID_ERROR("Could not create the signalfd: %s", strerror(errno));
+    return -1;
+  }
+
+  if (mIpcMgr->addPollFd(fd, EPOLLIN, new WifiStatsSignal(this, fd)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+WifiMessageHandler::buildReport(std::string* aOut)
+{
+  mStats.report(aOut, &mRequests);
+  mIpcMgr->reportLifecycle(aOut);
+  mIpcMgr->reportQueues(aOut);
+  mDriver.report(aOut);
+  mCommandCache.report(aOut);
+  mCommandFlights.report(aOut);
+  mEventCoalescer.report(aOut);
+  mScheduler.report(aOut);
+  WifiBufferPool::Instance()->report(aOut);
+}
+
+void
+WifiMessageHandler::dumpStats()
+{
+  std::string report;
+  size_t start = 0;
+  size_t end;
+
+  buildReport(&report);
+
+  // Logged whatever WIFID_LOG_LEVEL is, it was asked for.
+  while ((end = report.find('\n', start)) != std::string::npos) {
+    WifiLogger::Instance()->log(ANDROID_LOG_INFO, TAG_WIFID, FUNC, "%.*s",
+      static_cast<int>(end - start), report.data() + start);
+    start = end + 1;
   }
 }
 
 int
-WifiMessageHandler::sendMsg(uint8_t* aData, size_t aDataLen)
+WifiMessageHandler::sendMsg(uint32_t aConnId, uint8_t* aData, size_t aDataLen)
 {
   assert(aData);
 
-  return mIpcMgr->writeToIpc(aData, aDataLen);
+  return mIpcMgr->writeToIpc(aConnId, aData, aDataLen);
+}
+
+int
+WifiMessageHandler::sendMsg(uint32_t aConnId, const struct iovec* aIov, int aIovCnt)
+{
+  assert(aIov);
+
+  return mIpcMgr->writeToIpc(aConnId, aIov, aIovCnt);
 }
 
 int
 WifiMessageHandler::sendNotificationEvent(void* aEventMsg, size_t aLength)
 {
-  int ret;
+  const char* events = static_cast<const char*>(aEventMsg);
+  const char* end = events + aLength;
+  const char* event;
+  std::vector<uint32_t> classes;
+  std::vector<uint32_t> masks;
+  std::string selected;
+  uint32_t present = 0;
+  size_t len;
+  size_t i;
+  int ret = 0;
+
+  mIpcMgr->getEventMasks(&masks);
+
+  if (masks.size() == 1 && masks[0] == WIFI_EVENT_CLASS_ALL) {
+    return sendEvents(masks[0], events, aLength);
+  }
 
-  WifiNotificationMessage<struct WifiMsgNotifyEvent> notifyMsg(
-    reinterpret_cast<uint8_t*>(aEventMsg), aLength);
+  for (event = events; event < end; event += len + 1) {
+    len = strnlen(event, end - event);
+    classes.push_back(WifiEventFilter::classify(event, len));
+    present |= classes.back();
+  }
+
+  // Every peer gets the events it subscribed to, or nothing at all.
+  for (size_t m = 0; m < masks.size(); m++) {
+    if (!(present & masks[m])) {
+      continue;
+    }
+
+    if (!(present & ~masks[m])) {
+      if (sendEvents(masks[m], events, aLength) < 0) {
+        ret = -1;
+      }
+      continue;
+    }
 
-  ret = sendMsg(notifyMsg.getBuffer(), notifyMsg.getLength());
+    selected.clear();
+    for (event = events, i = 0; event < end; event += len + 1, i++) {
+      len = strnlen(event, end - event);
+      if (classes[i] & masks[m]) {
+        selected.append(event, len);
+        selected.push_back('\0');
+      }
+    }
 
-  if (ret < 0) {
-    WIFID_ERROR("Fail on sending the notification(%s).", strerror(errno));
+    if (sendEvents(masks[m], selected.data(), selected.size()) < 0) {
+      ret = -1;
+    }
   }
 
   return ret;
 }
 
+// Sends the events to the connections subscribed to aEventMask.
 int
-WifiMessageHandler::respondStatus(WifiMessageType aType, WifiStatusCode aStatus)
+WifiMessageHandler::sendEvents(uint32_t aEventMask, const void* aEvents,
+  size_t aLength)
 {
+  const size_t maxChunk = WIFI_MESSAGE_MAX_FRAME_SIZE - sizeof(struct WifiMsgNotify);
+  const uint8_t* data = static_cast<const uint8_t*>(aEvents);
+  const uint8_t* end;
+  size_t chunk;
   int ret;
-  uint16_t sessionId;
+  struct WifiMsgNotify notify;
+  struct iovec iov[2];
+
+  // The events are gathered from the caller's buffer as they are, in as
+  // many frames as needed.
+  do {
+    chunk = aLength;
+
+    if (chunk > maxChunk) {
+      // Cut after the last whole event so each chunk can be parsed alone.
+      end = static_cast<const uint8_t*>(memrchr(data, '\0', maxChunk));
+      chunk = end ? end + 1 - data : maxChunk;
+    }
 
-  sessionId = mSessionMap[aType].front();
-  mSessionMap[aType].pop();
+    WifiMsgInitHeader(&notify.hdr, WIFI_MESSAGE_NOTIFICATION,
+      WIFI_NOTIFICATION_EVENT | (chunk < aLength ? WIFI_MESSAGE_FLAG_MORE : 0),
+      sizeof(notify) + chunk);
 
-  WifiEmptyMessage<struct WifiMsgResp> respMsg(WIFI_MESSAGE_RESPONSE, aType);
-  respMsg->sessionId = sessionId;
-  respMsg->status = aStatus;
+    iov[0].iov_base = &notify;
+    iov[0].iov_len = sizeof(notify);
+    iov[1].iov_base = const_cast<uint8_t*>(data);
+    iov[1].iov_len = chunk;
 
-  ret = sendMsg(respMsg.getBuffer(), respMsg.getLength());
+    ret = mIpcMgr->broadcastToSubscribers(aEventMask, iov, 2);
+    mStats.onNotification(sizeof(notify) + chunk);
+
+    if (ret < 0) {
+      WIFID_ERROR("Fail on sending the notification(%s).", strerror(errno));
+    }
+
+    data += chunk;
+    aLength -= chunk;
+  } while (aLength > 0);
+
+  return ret;
+}
 
-  if (ret < 0) {
-    WIFID_ERROR("Fail on responding the message(%s).", strerror(errno));
+int
+WifiMessageHandler::respondStatus(WifiRequestId aId, WifiStatusCode aStatus)
+{
+  return respond(aId, aStatus, NULL, 0);
+}
+
+int
+WifiMessageHandler::respond(WifiRequestId aId, WifiStatusCode aStatus,
+  const void* aData, size_t aLength)
+{
+  int ret;
+  struct WifiRequest* req = mRequests.get(aId);
+
+  if (!req) {
+    WIFID_WARNING("Request(%u) is not pending.", aId);
+    return -1;
   }
 
+  // A successful response carries at least the payload of its type.
+  assert(aStatus != WIFI_STATUS_OK || req->msgType >= WIFI_MESSAGE_NUM_TYPES ||
+         aLength >= sSchema[req->msgType].responseLength);
+
+  if (req->batchId != WIFI_REQUEST_ID_INVALID) {
+    WifiRequest done = *req;
+
+    mStats.onResponse(done.connId, done.msgType, aStatus != WIFI_STATUS_OK,
+      sizeof(struct WifiMsgResp) + aLength, done.startTime);
+    finishRequest(aId);
+
+    return addToBatch(done.batchId, done.sessionId, done.msgType, aStatus,
+      aData, aLength);
+  }
+
+  ret = sendResponse(req->connId, req->sessionId, req->msgType,
+    aStatus, aData, aLength);
+
+  mStats.onResponse(req->connId, req->msgType,
+    aStatus != WIFI_STATUS_OK || ret < 0,
+    sizeof(struct WifiMsgResp) + aLength, req->startTime);
+
+  finishRequest(aId);
+
   return ret;
 }
 
+// Appends a response to the batch aBatchId, which is answered with the
+// last one.
+int
+WifiMessageHandler::addToBatch(WifiRequestId aBatchId, uint16_t aSessionId,
+  uint16_t aMsgType, WifiStatusCode aStatus, const void* aData, size_t aLength)
+{
+  std::map<WifiRequestId, Batch>::iterator it = mBatches.find(aBatchId);
+  struct WifiMsgResp resp;
+  std::string responses;
+
+  if (it == mBatches.end()) {
+    // The batch failed or its connection went away.
+    return -1;
+  }
+
+  // The requests still running are answered into the void.
+  if (it->second.responses.size() + sizeof(resp) + aLength >
+      WIFI_BATCH_MAX_RESPONSE_SIZE) {
+    WIFID_ERROR("Responses of batch(%u) exceed %d bytes.", aBatchId,
+      WIFI_BATCH_MAX_RESPONSE_SIZE);
+    mBatches.erase(it);
+    respondStatus(aBatchId, WIFI_STATUS_ERROR);
+    return -1;
+  }
+
+  WifiMsgInitHeader(&resp.hdr, WIFI_MESSAGE_RESPONSE, aMsgType,
+    sizeof(resp) + aLength);
+  resp.sessionId = aSessionId;
+  resp.status = aStatus;
+
+  it->second.responses.append(reinterpret_cast<const char*>(&resp), sizeof(resp));
+  it->second.responses.append(static_cast<const char*>(aData), aLength);
+
+  if (--it->second.pending > 0) {
+    return 0;
+  }
+
+  responses.swap(it->second.responses);
+  mBatches.erase(it);
+
+  return respond(aBatchId, WIFI_STATUS_OK, responses.data(), responses.size());
+}
+
+int
+WifiMessageHandler::sendResponse(uint32_t aConnId, uint16_t aSessionId,
+  uint16_t aMsgType, WifiStatusCode aStatus, const void* aData, size_t aLength)
+{
+  const size_t maxChunk = WIFI_MESSAGE_MAX_FRAME_SIZE - sizeof(struct WifiMsgResp);
+  const uint8_t* data = static_cast<const uint8_t*>(aData);
+  size_t chunk;
+  int ret;
+  struct WifiMsgResp resp;
+  struct iovec iov[2];
+
+  resp.sessionId = aSessionId;
+  resp.status = aStatus;
+
+  // Data larger than a frame goes out in chunks.
+  do {
+    chunk = aLength > maxChunk ? maxChunk : aLength;
+
+    WifiMsgInitHeader(&resp.hdr, WIFI_MESSAGE_RESPONSE,
+      aMsgType | (chunk < aLength ? WIFI_MESSAGE_FLAG_MORE : 0),
+      sizeof(resp) + chunk);
+
+    iov[0].iov_base = &resp;
+    iov[0].iov_len = sizeof(resp);
+    iov[1].iov_base = const_cast<uint8_t*>(data);
+    iov[1].iov_len = chunk;
+
+    ret = sendMsg(aConnId, iov, chunk ? 2 : 1);
+
+    if (ret < 0) {
+      WIFID_ERROR("Fail on responding the message(%s).", strerror(errno));
+      return ret;
+    }
+
+    data += chunk;
+    aLength -= chunk;
+  } while (aLength > 0);
+
+  return ret;
+}
+
+void
+WifiMessageHandler::handleDriverOperation(WifiRequestId aId,
+  const uint8_t* aBody, size_t aLength)
+{
+  if (mRequests.get(aId)->msgType == WIFI_MESSAGE_TYPE_LOAD_DRIVER) {
+    mDriver.load(aId);
+  } else {
+    mDriver.unload(aId);
+  }
+}
+
+void
+WifiMessageHandler::handleSupplicantOperation(WifiRequestId aId,
+  const uint8_t* aBody, size_t aLength)
+{
+  const struct WifiMsgStartStopSupp* body =
+    reinterpret_cast<const struct WifiMsgStartStopSupp*>(aBody);
+
+  handleHalOperation(aId, body->isP2pSupported);
+}
+
+void
+WifiMessageHandler::handleHalOperation(WifiRequestId aId, bool aP2pSupported)
+{
+  WifiMessageType type =
+    static_cast<WifiMessageType>(mRequests.get(aId)->msgType);
+
+  if (!mHal || !mWorkerPool) {
+    WIFID_ERROR("No HAL to handle the request Type(%d).", type);
+    respondStatus(aId, WIFI_STATUS_ERROR);
+    return;
+  }
+
+  // Blocking HAL calls must not hold up the loop.
+  mWorkerPool->submit(new WifiHalTask(mHal, this, aId, type, aP2pSupported));
+}
+
+bool
+WifiMessageHandler::isSupplicantReady()
+{
+  return mSuppCtrl && mSuppCtrl->isAvailable();
+}
+
+int
+WifiMessageHandler::connectToSupplicant()
+{
+  if (!mSuppCtrl || mSuppCtrl->open() < 0) {
+    return -1;
+  }
+
+  if (mSuppMonitor->start() < 0) {
+    WIFID_ERROR("Could not monitor the supplicant events.");
+    mSuppCtrl->close();
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+WifiMessageHandler::closeSupplicantConnection()
+{
+  if (mSuppCtrl) {
+    mSuppMonitor->stop();
+    mSuppCtrl->close();
+  }
+
+  // Without the monitor nothing would invalidate the caches.
+  mScanResults.invalidate();
+  mCommandCache.invalidateAll();
+  mCommandFlights.closeAll();
+}
+
 void
-WifiMessageHandler::handleMessageVersion()
+WifiMessageHandler::handleConnectToSupplicant(WifiRequestId aId,
+  const uint8_t* aBody, size_t aLength)
 {
+  respondStatus(aId, connectToSupplicant() < 0 ? WIFI_STATUS_ERROR :
+                                                 WIFI_STATUS_OK);
+}
+
+void
+WifiMessageHandler::handleCloseSupplicantConnection(WifiRequestId aId,
+  const uint8_t* aBody, size_t aLength)
+{
+  closeSupplicantConnection();
+
+  respondStatus(aId, WIFI_STATUS_OK);
+}
+
+void
+WifiMessageHandler::handleBringUp(WifiRequestId aId, const uint8_t* aBody,
+  size_t aLength)
+{
+  const struct WifiMsgStartStopSupp* body =
+    reinterpret_cast<const struct WifiMsgStartStopSupp*>(aBody);
+
+  mBringUp.bringUp(aId, body->isP2pSupported);
+}
+
+void
+WifiMessageHandler::handleTearDown(WifiRequestId aId, const uint8_t* aBody,
+  size_t aLength)
+{
+  const struct WifiMsgStartStopSupp* body =
+    reinterpret_cast<const struct WifiMsgStartStopSupp*>(aBody);
+
+  mBringUp.tearDown(aId, body->isP2pSupported);
+}
+
+void
+WifiMessageHandler::handleBatch(WifiRequestId aId, const uint8_t* aBody,
+  size_t aLength)
+{
+  struct WifiRequest* req = mRequests.get(aId);
+  uint32_t connId = req->connId;
+  size_t offset = 0;
+  size_t count = 0;
+
+  // Check every request before running any.
+  while (offset < aLength) {
+    WifiMessageView<struct WifiMsgReq> sub(aBody + offset, aLength - offset);
+
+    if (!sub.isValid() || sub->hdr.msgCategory != WIFI_MESSAGE_REQUEST) {
+      WIFID_ERROR("Batch has a malformed request at offset %zu.", offset);
+      respondStatus(aId, WIFI_STATUS_ERROR);
+      return;
+    }
+    offset += sizeof(struct WifiMsgHeader) + sub->hdr.len;
+    count++;
+  }
+
+  if (count > WIFI_BATCH_MAX_REQUESTS) {
+    WIFID_ERROR("Batch has %zu requests, more than %d.", count,
+      WIFI_BATCH_MAX_REQUESTS);
+    respondStatus(aId, WIFI_STATUS_ERROR);
+    return;
+  }
+
+  if (count == 0) {
+    respond(aId, WIFI_STATUS_OK, NULL, 0);
+    return;
+  }
+
+  // Requests may be answered while the batch is still being dispatched.
+  mBatches[aId].pending = count;
+
+  for (offset = 0; offset < aLength && mBatches.count(aId); ) {
+    WifiMessageView<struct WifiMsgReq> sub(aBody + offset, aLength - offset);
+
+    offset += sizeof(struct WifiMsgHeader) + sub->hdr.len;
+    dispatch(connId, sub, aId);
+  }
+}
+
+void
+WifiMessageHandler::handleCommand(WifiRequestId aId, const uint8_t* aBody,
+  size_t aLength)
+{
+  const char* cmd = reinterpret_cast<const char*>(aBody);
+  const std::string* reply;
+
+  if (!mSuppCtrl || !mSuppCtrl->isOpen()) {
+    WIFID_ERROR("Not connected to the supplicant.");
+    respondStatus(aId, WIFI_STATUS_ERROR);
+    return;
+  }
+
+  if (aLength == 0) {
+    respondStatus(aId, WIFI_STATUS_ERROR);
+    return;
+  }
+
+  reply = mCommandCache.lookup(aId, cmd, aLength);
+  if (reply) {
+    respond(aId, WIFI_STATUS_OK, reply->data(), reply->size());
+    return;
+  }
+
+  if (WifiScanResults::isScanResultsCommand(cmd, aLength) &&
+      respondFromScanResults(aId, cmd, aLength)) {
+    return;
+  }
+
+  // The same query already on its way answers this one too.
+  if (WifiCommandCache::isQuery(cmd, aLength) &&
+      mCommandFlights.join(aId, cmd, aLength)) {
+    mCommandCache.cancelFill(aId);
+    return;
+  }
+
+  // Queries sent before this command may answer the state before it.
+  if (!WifiCommandCache::isQuery(cmd, aLength)) {
+    mCommandFlights.closeAll();
+  }
+
+  if (mSuppCtrl->sendCommand(aId, cmd, aLength) < 0) {
+    if (aId == mScanFillId) {
+      mScanFillId = WIFI_REQUEST_ID_INVALID;
+    }
+    mCommandCache.cancelFill(aId);
+    answerFollowers(aId, WIFI_STATUS_ERROR, NULL, 0);
+    respondStatus(aId, WIFI_STATUS_ERROR);
+  }
+}
+
+// Hands the reply of the command of aId to the requests merged into it,
+// even if aId itself went away meanwhile.
+void
+WifiMessageHandler::answerFollowers(WifiRequestId aId, WifiStatusCode aStatus,
+  void* aData, size_t aLength)
+{
+  std::vector<WifiRequestId> followers;
+
+  mCommandFlights.land(aId, &followers);
+
+  for (size_t i = 0; i < followers.size(); i++) {
+    processResponse(followers[i], WIFI_MESSAGE_TYPE_COMMAND, aStatus,
+      aData, aLength);
+  }
+}
+
+bool
+WifiMessageHandler::respondFromScanResults(WifiRequestId aId,
+  const char* aCmd, size_t aLen)
+{
+  struct WifiRequest* req;
   int ret;
-  uint16_t sessionId;
 
-  sessionId = mSessionMap[WIFI_MESSAGE_TYPE_VERSION].front();
-  mSessionMap[WIFI_MESSAGE_TYPE_VERSION].pop();
+  if (!mScanResults.lookup(aCmd, aLen)) {
+    // Let the reply of this command refill the table, unless another
+    // one is already on its way.
+    if (mScanFillId == WIFI_REQUEST_ID_INVALID) {
+      mScanFillId = aId;
+      mScanFillGeneration = mScanResults.getGeneration();
+      mScanFillCmd.assign(aCmd, aLen);
+    }
+    return false;
+  }
+
+  req = mRequests.get(aId);
+  assert(req);
+
+  if (req->batchId != WIFI_REQUEST_ID_INVALID) {
+    // A batch holds whole responses, the reply is built at once.
+    WifiScanResultsSource source(&mScanResults);
+    std::string reply(mScanResults.getReplyLength(), '\0');
+    size_t len = 0;
+    ssize_t chunk;
+
+    while (!source.isDone() && len < reply.size() &&
+           (chunk = source.read(reinterpret_cast<uint8_t*>(&reply[len]),
+                                reply.size() - len)) > 0) {
+      len += chunk;
+    }
+
+    respond(aId, WIFI_STATUS_OK, reply.data(), len);
+    return true;
+  }
+
+  // The reply is rebuilt chunk by chunk as the client drains it.
+  ret = mIpcMgr->streamToIpc(req->connId, new WifiResponseStream(
+    req->sessionId, req->msgType, new WifiScanResultsSource(&mScanResults)));
 
-  WifiResponseMessage<struct WifiMsgVersion> respMsg(WIFI_MESSAGE_TYPE_VERSION);
+  mStats.onResponse(req->connId, req->msgType, ret < 0,
+    sizeof(struct WifiMsgResp) + mScanResults.getReplyLength(), req->startTime);
 
-  respMsg.setStatus(WIFI_STATUS_OK);
-  respMsg.setSessionId(sessionId);
-  respMsg->majorVersion = MAJOR_VER;
-  respMsg->minorVersion = MINOR_VER;
+  finishRequest(aId);
+
+  return true;
+}
+
+void
+WifiMessageHandler::invalidateOnEvents(const char* aEvents, size_t aLength)
+{
+  const char* event = aEvents;
+  const char* end = aEvents + aLength;
+
+  bool scanResults = false;
+
+  // The events of a batch are NUL-terminated strings.
+  while (event < end) {
+    size_t len = strnlen(event, end - event);
+
+    if (mCommandCache.onEvent(event, len)) {
+      mCommandFlights.closeAll();
+    }
+
+    if (!strncmp(event, SCAN_RESULTS_EVENT, strlen(SCAN_RESULTS_EVENT))) {
+      scanResults = true;
+    }
+    event += len + 1;
+  }
+
+  if (scanResults) {
+    struct WifiScanResultsStats stats;
+
+    mScanResults.invalidate();
+    mScanResults.getStats(&stats);
+    WIFID_DEBUG("Scan results cache: %u hits, %u misses, %u fills.",
+      stats.hits, stats.misses, stats.fills);
+  }
+}
+
+void
+WifiMessageHandler::handleStats(WifiRequestId aId, const uint8_t* aBody,
+  size_t aLength)
+{
+  std::string report;
+
+  buildReport(&report);
+  respond(aId, WIFI_STATUS_OK, report.data(), report.size());
+}
+
+void
+WifiMessageHandler::handleSubscribe(WifiRequestId aId, const uint8_t* aBody,
+  size_t aLength)
+{
+  const struct WifiMsgSubscribe* body =
+    reinterpret_cast<const struct WifiMsgSubscribe*>(aBody);
+
+  if (mIpcMgr->setEventMask(mRequests.get(aId)->connId, body->eventMask) < 0) {
+    respondStatus(aId, WIFI_STATUS_ERROR);
+    return;
+  }
+
+  respondStatus(aId, WIFI_STATUS_OK);
+}
+
+void
+WifiMessageHandler::handleShmTransport(WifiRequestId aId, const uint8_t* aBody,
+  size_t aLength)
+{
+  struct WifiRequest* req = mRequests.get(aId);
+  uint8_t frame[sizeof(struct WifiMsgResp) + sizeof(struct WifiMsgShmTransport)];
+  struct WifiMsgResp* resp = reinterpret_cast<struct WifiMsgResp*>(frame);
+  struct WifiMsgShmTransport* body =
+    reinterpret_cast<struct WifiMsgShmTransport*>(resp->data);
+
+  if (!req) {
+    return;
+  }
+
+  WifiMsgInitHeader(&resp->hdr, WIFI_MESSAGE_RESPONSE, req->msgType, sizeof(frame));
+  resp->sessionId = req->sessionId;
+  resp->status = WIFI_STATUS_OK;
+  body->ringSize = WifiShmIpcHandler::RING_SIZE;
+
+  // The response goes out on the socket with the descriptors, everything
+  // after it through the rings.
+  if (mIpcMgr->upgradeToShm(req->connId, frame, sizeof(frame)) < 0) {
+    WIFID_WARNING("Stay on the socket for connection %u.", req->connId);
+    respondStatus(aId, WIFI_STATUS_ERROR);
+    return;
+  }
+
+  mStats.onResponse(req->connId, req->msgType, false, sizeof(frame),
+    req->startTime);
+  finishRequest(aId);
+}
+
+void
+WifiMessageHandler::handleMessageVersion(WifiRequestId aId,
+  const uint8_t* aBody, size_t aLength)
+{
+  struct WifiMsgVersion version;
 
-  ret = sendMsg(respMsg.getBuffer(), respMsg.getLength());
+  version.majorVersion = MAJOR_VER;
+  version.minorVersion = MINOR_VER;
 
-  if (ret < 0) {
+  if (respond(aId, WIFI_STATUS_OK, &version, sizeof(version)) < 0) {
     WIFID_ERROR("Fail on responding the message of getting version(%s).", strerror(errno));
   }
 }
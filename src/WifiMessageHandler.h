@@ -20,164 +20,122 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <queue>
+#include <string.h>
+#include <sys/uio.h>
 #include <map>
+#include <string>
 
+#include "WifiBringUp.h"
+#include "WifiCommandCache.h"
+#include "WifiCommandFlights.h"
+#include "WifiDriverState.h"
+#include "WifiEventCoalescer.h"
 #include "WifiGonkMessage.h"
+#include "WifiHal.h"
 #include "WifiIpcManager.h"
-
-#define WIFI_MSG_GET_HEADER(x) (reinterpret_cast<struct WifiMsgHeader*>(x))
-#define WIFI_MSG_GET_CATEGORY(x) (WIFI_MSG_GET_HEADER(x)->msgCategory)
-#define WIFI_MSG_GET_TYPE(x) (WIFI_MSG_GET_HEADER(x)->msgType)
-#define WIFI_MSG_GET_LEN(x) (WIFI_MSG_GET_HEADER(x)->len)
-
-#define WIFI_MSG_GET_REQ(x) (reinterpret_cast<struct WifiMsgReq*>(x))
-#define WIFI_MSG_GET_REQ_SESSION_ID(x) (WIFI_MSG_GET_REQ(x)->sessionId)
-
-class WifiMessageHandler
+#include "WifiMessageSchema.h"
+#include "WifiRequestTable.h"
+#include "WifiScanResults.h"
+#include "WifiScheduler.h"
+#include "WifiStats.h"
+#include "WifiWorkerPool.h"
+
+// The length field of the header excludes the header itself.
+inline void
+WifiMsgInitHeader(struct WifiMsgHeader* aHdr, uint16_t aMsgCategory,
+                  uint16_t aMsgType, size_t aTotalLen)
 {
-public:
-  WifiMessageHandler();
-  ~WifiMessageHandler();
-
-  void setIpcManager(WifiIpcManager* aIpcMgr);
-  int processMsg(uint8_t* aData, size_t aDataLen);
-  int sendMsg(uint8_t* aData, size_t aDataLen);
-
-  void processNotification(WifiNotificationType aType, void* aData, size_t aLength);
-  void processResponse(WifiMessageType aType, WifiStatusCode aStatus,
-                         void* aData, size_t aLength);
-
-private:
-  void handleMessageVersion();
-
-  int sendNotificationEvent(void* aEventMsg, size_t aLength);
-  int respondStatus(WifiMessageType aType, WifiStatusCode aStatus);
-
-  WifiIpcManager* mIpcMgr;
-  std::map< uint16_t, std::queue<uint16_t> > mSessionMap;
-};
-
+  aHdr->msgCategory = aMsgCategory;
+  aHdr->msgType = aMsgType;
+  aHdr->len = aTotalLen - sizeof(struct WifiMsgHeader);
+}
+
+/**
+ * Non-owning view of a received message. The header and the body are
+ * read in place from the receive buffer, nothing is copied.
+ */
 template<typename T>
-class WifiEmptyMessage
+class WifiMessageView
 {
 public:
-  WifiEmptyMessage(uint8_t* aData, size_t aDataLen)
-    : mDataLength(aDataLen)
+  WifiMessageView(const uint8_t* aData, size_t aDataLen)
+    : mData(aData)
+    , mDataLength(aDataLen)
   {
     assert(aData);
-
-    mData = new uint8_t[aDataLen];
-    memcpy(mData, aData, aDataLen * sizeof(uint8_t));
-    mMsg = reinterpret_cast<T*>(mData);
   }
 
-  WifiEmptyMessage(WifiMessageCategory aMsgCategory, WifiMessageType aMsgType)
+  // Whether the buffer covers the header of T and the announced length.
+  bool isValid() const
   {
-    size_t length = sizeof(T);
-
-    mData = new uint8_t[length];
-    memset(mData, 0 , length * sizeof(uint8_t));
-    mMsg = reinterpret_cast<T*>(mData);
-    mMsg->hdr.msgCategory = aMsgCategory;
-    mMsg->hdr.msgType = aMsgType;
-    mMsg->hdr.len = length;
-    mDataLength = length;
+    return mDataLength >= sizeof(T) &&
+      sizeof(struct WifiMsgHeader) + (*this)->hdr.len <= mDataLength;
   }
 
-  virtual ~WifiEmptyMessage()
+  const T* operator->() const
   {
-    delete mData;
+    return reinterpret_cast<const T*>(mData);
   }
 
-  uint8_t* getBuffer()
+  const uint8_t* getBody() const
   {
-    assert(mData);
-
-    return mData;
+    return mData + sizeof(T);
   }
 
-  size_t getLength()
+  size_t getBodyLength() const
   {
-    return mDataLength;
+    return sizeof(struct WifiMsgHeader) + (*this)->hdr.len - sizeof(T);
   }
 
-  T* operator->() const
+  // Returns NULL if the body is too short for B.
+  template<typename B>
+  const B* getBodyAs() const
   {
-    assert(mMsg);
-
-    return mMsg;
+    if (getBodyLength() < sizeof(B)) {
+      return NULL;
+    }
+    return reinterpret_cast<const B*>(getBody());
   }
 
 private:
-  T* mMsg;
-  uint8_t* mData;
+  const uint8_t* mData;
   size_t mDataLength;
 };
 
-template<typename T1, typename T2>
-class WifiMessage
+/**
+ * Serializes a message straight into a caller provided buffer, typically
+ * on the stack, so building a response needs no allocation or copy.
+ */
+template<typename T>
+class WifiMessageBuilder
 {
 public:
-  // Constructor for deserializing.
-  WifiMessage(const uint8_t* aData, size_t aDataLen)
-    : mDataLength(aDataLen)
+  WifiMessageBuilder(uint8_t* aBuf, size_t aBufLen,
+    WifiMessageCategory aMsgCategory, uint16_t aMsgType, size_t aBodyLen)
+    : mData(aBuf)
+    , mDataLength(sizeof(T) + aBodyLen)
   {
-    assert(aData);
+    assert(aBuf);
+    assert(aBufLen >= mDataLength);
 
-    mData = new uint8_t[aDataLen];
-    memcpy(mData, aData, aDataLen * sizeof(uint8_t));
-    mMsg = reinterpret_cast<T1*>(mData);
-    mMsgBody = reinterpret_cast<T2*>(mData + sizeof(T1));
-  }
-
-  // Constructor for serializing with empty message body.
-  WifiMessage(WifiMessageCategory aMsgCategory, WifiMessageType aMsgType)
-  {
-    size_t length = sizeof(T1) + sizeof(T2);
-
-    mData = new uint8_t[length];
-    memset(mData, 0 , length * sizeof(uint8_t));
-    mMsg = reinterpret_cast<T1*>(mData);
-    mMsg->hdr.msgCategory = aMsgCategory;
-    mMsg->hdr.msgType = aMsgType;
-    mMsg->hdr.len = length;
-    mMsgBody = reinterpret_cast<T2*>(mData + sizeof(T1));
-    mDataLength = length;
+    memset(mData, 0, sizeof(T));
+    mMsg = reinterpret_cast<T*>(mData);
+    WifiMsgInitHeader(&mMsg->hdr, aMsgCategory, aMsgType, mDataLength);
   }
 
-  // Constructor for serializing with message.
-  WifiMessage(WifiMessageCategory aMsgCategory, WifiMessageType aMsgType,
-    const T2* aMsgBody, size_t aMsgLen)
-    : mDataLength(aMsgLen)
+  T* operator->() const
   {
-    size_t length;
-
-    assert(aMsgBody);
-
-    length = sizeof(T1) + aMsgLen;
-
-    mData = new uint8_t[length];
-    memset(mData, 0 , length * sizeof(uint8_t));
-    mMsg = reinterpret_cast<T1*>(mData);
-    mMsg->hdr.msgCategory = aMsgCategory;
-    mMsg->hdr.msgType = aMsgType;
-    mMsg->hdr.len = length;
-
-    mMsgBody = reinterpret_cast<T2*>(mData + sizeof(T1));
-
-    memcpy(mMsgBody, aMsgBody, aMsgLen * sizeof(uint8_t));
+    return mMsg;
   }
 
-  virtual ~WifiMessage()
+  template<typename B>
+  B* getBody()
   {
-    delete mData;
+    return reinterpret_cast<B*>(mData + sizeof(T));
   }
 
   uint8_t* getBuffer()
   {
-    assert(mData);
-
     return mData;
   }
 
@@ -186,126 +144,141 @@ public:
     return mDataLength;
   }
 
-  T2* operator->() const
-  {
-    assert(mMsgBody);
-
-    return mMsgBody;
-  }
-
-protected:
-  T1* mMsg;
-  T2* mMsgBody;
+private:
+  T* mMsg;
   uint8_t* mData;
   size_t mDataLength;
 };
 
-template<typename T>
-class WifiRequestMessage
-  : WifiMessage<struct WifiMsgReq, T>
-{
-public:
-  WifiRequestMessage(const uint8_t* aData, size_t aDataLen)
-    : WifiMessage<struct WifiMsgReq, T>(aData, aDataLen)
-  {
-  }
-
-  WifiRequestMessage(WifiMessageType aMsgType)
-    : WifiMessage<struct WifiMsgReq, T>(WIFI_MESSAGE_REQUEST, aMsgType)
-  {
-  }
-
-  WifiRequestMessage(WifiMessageType aMsgType, const T* aMsgBody, size_t aMsgLen)
-    : WifiMessage<struct WifiMsgReq, T>(WIFI_MESSAGE_REQUEST,
-        aMsgType, aMsgBody, aMsgLen)
-  {
-  }
+class WifiSupplicantCtrl;
+class WifiSupplicantMonitor;
 
-  ~WifiRequestMessage()
-  {
-  }
-
-  uint16_t getSessionId()
-  {
-    return WifiMessage<struct WifiMsgReq, T>::mMsg->aSessionId;
-  }
-
-  void setSessionId(uint16_t aSessionId)
-  {
-    WifiMessage<struct WifiMsgReq, T>::mMsg->sessionId = aSessionId;
-  }
-};
-
-template<typename T>
-class WifiResponseMessage
-  : public WifiMessage<struct WifiMsgResp, T>
+class WifiMessageHandler
 {
 public:
-  WifiResponseMessage(const uint8_t* aData, size_t aDataLen)
-    : WifiMessage<struct WifiMsgResp, T>(aData, aDataLen)
-  {
-  }
-
-  WifiResponseMessage(WifiMessageType aMsgType)
-    : WifiMessage<struct WifiMsgResp, T>(WIFI_MESSAGE_RESPONSE, aMsgType)
-  {
-  }
-
-  WifiResponseMessage(WifiMessageType aMsgType, const T* aMsgBody, size_t aMsgLen)
-    : WifiMessage<struct WifiMsgResp, T>(WIFI_MESSAGE_RESPONSE,
-        aMsgType, aMsgBody, aMsgLen)
-  {
-  }
-
-  ~WifiResponseMessage()
-  {
-  }
+  WifiMessageHandler();
+  ~WifiMessageHandler();
 
-  uint16_t getSessionId()
-  {
-    return WifiMessage<struct WifiMsgResp, T>::mMsg->aSessionId;
-  }
+  void setIpcManager(WifiIpcManager* aIpcMgr);
+  void setHal(WifiHal* aHal, WifiWorkerPool* aWorkerPool);
+  // How long the driver stays loaded after an unload request, in case it
+  // is loaded again. 0 unloads it right away.
+  void setDriverUnloadDelay(uint64_t aDelayUs);
+  // How long supplicant events are held back to be sent together, and at
+  // most how many. 0 sends them as they come.
+  void setEventWindow(uint64_t aWindowUs, size_t aMaxEvents);
+  void setSupplicantCtrl(WifiSupplicantCtrl* aSuppCtrl,
+                         WifiSupplicantMonitor* aSuppMonitor);
+  int processMsg(uint32_t aConnId, uint8_t* aData, size_t aDataLen);
+  int sendMsg(uint32_t aConnId, uint8_t* aData, size_t aDataLen);
+  int sendMsg(uint32_t aConnId, const struct iovec* aIov, int aIovCnt);
 
-  void setSessionId(uint16_t aSessionId)
-  {
-    WifiMessage<struct WifiMsgResp, T>::mMsg->sessionId = aSessionId;
-  }
+  void processNotification(WifiNotificationType aType, void* aData, size_t aLength);
+  void processResponse(WifiRequestId aId, WifiMessageType aType,
+                         WifiStatusCode aStatus, void* aData, size_t aLength);
 
-  uint16_t getStatus()
-  {
-    return WifiMessage<struct WifiMsgResp, T>::mMsg->status;
-  }
+  // Drops the pending requests of a closed connection.
+  void removeConnection(uint32_t aConnId);
 
-  void setStatus(WifiStatusCode aStatus)
-  {
-    WifiMessage<struct WifiMsgResp, T>::mMsg->status = aStatus;
-  }
-};
+  // Logs the statistics whenever aSignal is received. The signal must be
+  // blocked in every thread.
+  int watchStatsSignal(int aSignal);
+  void dumpStats();
 
-template<typename T>
-class WifiNotificationMessage
-  : public WifiMessage<struct WifiMsgNotify, T>
-{
-public:
-  WifiNotificationMessage(const uint8_t* aData, size_t aDataLen)
-    : WifiMessage<struct WifiMsgNotify, T>(aData, aDataLen)
-  {
-  }
+  // Connection to the supplicant, also used by WifiBringUp.
+  bool isSupplicantReady();
+  int connectToSupplicant();
+  void closeSupplicantConnection();
 
-  WifiNotificationMessage(WifiMessageType aMsgType)
-    : WifiMessage<struct WifiMsgNotify, T>(WIFI_MESSAGE_NOTIFICATION, aMsgType)
-  {
-  }
+  // Sends a batch of events to the connections subscribed to them, used
+  // by WifiEventCoalescer.
+  int sendNotificationEvent(void* aEventMsg, size_t aLength);
 
-  WifiNotificationMessage(WifiMessageType aMsgType, const T* aMsgBody, size_t aMsgLen)
-    : WifiMessage<struct WifiMsgNotify, T>(WIFI_MESSAGE_NOTIFICATION,
-        aMsgType, aMsgBody, aMsgLen)
-  {
-  }
+private:
+  // Appends the report shared by dumpStats() and the STATS request.
+  void buildReport(std::string* aOut);
+
+  // Handles a request whose payload passed the length check of its type.
+  typedef void (WifiMessageHandler::*RequestHandler)(WifiRequestId aId,
+    const uint8_t* aBody, size_t aLength);
+
+  // One entry per message type, generated from WIFI_MESSAGE_SCHEMA.
+  struct MessageSchema {
+    size_t requestLength;       // at least
+    size_t responseLength;      // at least, on success
+    bool hasResponseData;
+    WifiPriority priority;
+    RequestHandler handler;
+  };
+
+  static const MessageSchema sSchema[WIFI_MESSAGE_NUM_TYPES];
+
+  // Responses of the requests of a BATCH request collected so far.
+  struct Batch {
+    std::string responses;
+    size_t pending;
+  };
+
+  static WifiPriority getPriority(uint16_t aMsgType);
+
+  int dispatch(uint32_t aConnId, const WifiMessageView<struct WifiMsgReq>& aReq,
+               WifiRequestId aBatchId);
+  void finishRequest(WifiRequestId aId);
+  void runQueued();
+
+  void handleMessageVersion(WifiRequestId aId, const uint8_t* aBody, size_t aLength);
+  void handleDriverOperation(WifiRequestId aId, const uint8_t* aBody, size_t aLength);
+  void handleSupplicantOperation(WifiRequestId aId, const uint8_t* aBody,
+                                 size_t aLength);
+  void handleHalOperation(WifiRequestId aId, bool aP2pSupported);
+  void handleConnectToSupplicant(WifiRequestId aId, const uint8_t* aBody,
+                                 size_t aLength);
+  void handleCloseSupplicantConnection(WifiRequestId aId, const uint8_t* aBody,
+                                       size_t aLength);
+  void handleCommand(WifiRequestId aId, const uint8_t* aBody, size_t aLength);
+  void handleStats(WifiRequestId aId, const uint8_t* aBody, size_t aLength);
+  void handleShmTransport(WifiRequestId aId, const uint8_t* aBody, size_t aLength);
+  void handleBringUp(WifiRequestId aId, const uint8_t* aBody, size_t aLength);
+  void handleTearDown(WifiRequestId aId, const uint8_t* aBody, size_t aLength);
+  void handleBatch(WifiRequestId aId, const uint8_t* aBody, size_t aLength);
+  void handleSubscribe(WifiRequestId aId, const uint8_t* aBody, size_t aLength);
+
+  bool respondFromScanResults(WifiRequestId aId, const char* aCmd, size_t aLen);
+  void invalidateOnEvents(const char* aEvents, size_t aLength);
+  void answerFollowers(WifiRequestId aId, WifiStatusCode aStatus,
+                       void* aData, size_t aLength);
+  int sendEvents(uint32_t aEventMask, const void* aEvents, size_t aLength);
+  int respondStatus(WifiRequestId aId, WifiStatusCode aStatus);
+  int respond(WifiRequestId aId, WifiStatusCode aStatus,
+              const void* aData, size_t aLength);
+  int sendResponse(uint32_t aConnId, uint16_t aSessionId, uint16_t aMsgType,
+                   WifiStatusCode aStatus, const void* aData, size_t aLength);
+  int addToBatch(WifiRequestId aBatchId, uint16_t aSessionId, uint16_t aMsgType,
+                 WifiStatusCode aStatus, const void* aData, size_t aLength);
 
-  ~WifiNotificationMessage()
-  {
-  }
+  WifiIpcManager* mIpcMgr;
+  WifiHal* mHal;
+  WifiWorkerPool* mWorkerPool;
+  WifiSupplicantCtrl* mSuppCtrl;
+  WifiSupplicantMonitor* mSuppMonitor;
+  WifiDriverState mDriver;
+  WifiBringUp mBringUp;
+  WifiEventCoalescer mEventCoalescer;
+  // Requests waiting for their response, in any order.
+  WifiRequestTable mRequests;
+  WifiScheduler mScheduler;
+  bool mRunningQueued;
+  // Pending BATCH requests by id.
+  std::map<WifiRequestId, Batch> mBatches;
+  WifiStats mStats;
+
+  WifiScanResults mScanResults;
+  WifiCommandCache mCommandCache;
+  WifiCommandFlights mCommandFlights;
+  // The SCAN_RESULTS command whose reply refills mScanResults.
+  WifiRequestId mScanFillId;
+  uint32_t mScanFillGeneration;
+  std::string mScanFillCmd;
 };
 
 #endif // WifiMessageHandler_h
\ No newline at end of file
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiMessageSchema_h
+#define WifiMessageSchema_h
+
+#include <stddef.h>
+
+#include "WifiGonkMessage.h"
+
+/**
+ * Schema of the request types, one row per WifiMessageType in the order
+ * of the enum:
+ *
+ *   X(type, request payload, response payload, priority, request handler)
+ *
+ * The payloads name the struct following the session Id (and the status)
+ * of the request and of a successful response. WifiMsgNoData stands for
+ * none, WifiMsgText for a text of any length and WifiMsgFrames for
+ * complete messages back to back.
+ *
+ * The priority is the WifiPriority class the request is scheduled in,
+ * CONTROL, INTERACTIVE or BULK, see WifiScheduler.
+ *
+ * Everything per type is generated from these rows: the dispatch table
+ * of WifiMessageHandler with its length checks, the type names of the
+ * statistics, and a compile-time check that the rows follow the enum.
+ * Adding a message type is an enum value and a row.
+ */
+#define WIFI_MESSAGE_SCHEMA(X)                                                   \
+  X(VERSION,                     WifiMsgNoData,        WifiMsgVersion,           \
+    INTERACTIVE, handleMessageVersion)                                           \
+  X(LOAD_DRIVER,                 WifiMsgNoData,        WifiMsgNoData,            \
+    CONTROL, handleDriverOperation)                                              \
+  X(UNLOAD_DRIVER,               WifiMsgNoData,        WifiMsgNoData,            \
+    CONTROL, handleDriverOperation)                                              \
+  X(START_SUPPLICANT,            WifiMsgStartStopSupp, WifiMsgNoData,            \
+    CONTROL, handleSupplicantOperation)                                          \
+  X(STOP_SUPPLICANT,             WifiMsgStartStopSupp, WifiMsgNoData,            \
+    CONTROL, handleSupplicantOperation)                                          \
+  X(CONNECT_TO_SUPPLICANT,       WifiMsgNoData,        WifiMsgNoData,            \
+    CONTROL, handleConnectToSupplicant)                                          \
+  X(CLOSE_SUPPLICANT_CONNECTION, WifiMsgNoData,        WifiMsgNoData,            \
+    CONTROL, handleCloseSupplicantConnection)                                    \
+  X(COMMAND,                     WifiMsgText,          WifiMsgText,              \
+    BULK, handleCommand)                                                         \
+  X(STATS,                       WifiMsgNoData,        WifiMsgText,              \
+    INTERACTIVE, handleStats)                                                    \
+  X(SHM_TRANSPORT,               WifiMsgNoData,        WifiMsgShmTransport,      \
+    INTERACTIVE, handleShmTransport)                                             \
+  X(BRING_UP,                    WifiMsgStartStopSupp, WifiMsgStageTimes,        \
+    CONTROL, handleBringUp)                                                      \
+  X(TEAR_DOWN,                   WifiMsgStartStopSupp, WifiMsgStageTimes,        \
+    CONTROL, handleTearDown)                                                     \
+  X(BATCH,                       WifiMsgFrames,        WifiMsgFrames,            \
+    BULK, handleBatch)                                                           \
+  X(SUBSCRIBE,                   WifiMsgSubscribe,     WifiMsgNoData,            \
+    INTERACTIVE, handleSubscribe)
+
+struct WifiMsgNoData {};
+struct WifiMsgText {};
+struct WifiMsgFrames {};
+
+/**
+ * Length of a payload struct on the wire. The data of a message may be
+ * longer than its payload, newer peers can append fields.
+ */
+template<typename T>
+struct WifiPayloadTraits
+{
+  static const size_t minLength = sizeof(T);
+  static const bool hasData = true;
+};
+
+template<>
+struct WifiPayloadTraits<WifiMsgNoData>
+{
+  static const size_t minLength = 0;
+  static const bool hasData = false;
+};
+
+template<>
+struct WifiPayloadTraits<WifiMsgText>
+{
+  static const size_t minLength = 0;
+  static const bool hasData = true;
+};
+
+template<>
+struct WifiPayloadTraits<WifiMsgFrames>
+{
+  static const size_t minLength = 0;
+  static const bool hasData = true;
+};
+
+#define WIFI_MESSAGE_SCHEMA_COUNT(type, req, resp, priority, handler) + 1
+
+// Number of request types.
+static const size_t WIFI_MESSAGE_NUM_TYPES = 0 WIFI_MESSAGE_SCHEMA(WIFI_MESSAGE_SCHEMA_COUNT);
+
+#define WIFI_MESSAGE_SCHEMA_INDEX(type, req, resp, priority, handler) \
+  WIFI_MESSAGE_SCHEMA_INDEX_##type,
+
+#define WIFI_MESSAGE_SCHEMA_CHECK(type, req, resp, priority, handler)    \
+  typedef char WifiMessageSchemaCheck_##type[                            \
+    static_cast<int>(WIFI_MESSAGE_SCHEMA_INDEX_##type) ==                \
+    static_cast<int>(WIFI_MESSAGE_TYPE_##type) ? 1 : -1];
+
+// Fails to compile if a row is out of the order of WifiMessageType.
+enum {
+  WIFI_MESSAGE_SCHEMA(WIFI_MESSAGE_SCHEMA_INDEX)
+};
+WIFI_MESSAGE_SCHEMA(WIFI_MESSAGE_SCHEMA_CHECK)
+
+#endif // WifiMessageSchema_h
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "WifiRequestTable.h"
+#include "WifiStats.h"
+
+WifiRequestTable::WifiRequestTable()
+  : mFreeCount(MAX_REQUESTS)
+  , mCount(0)
+{
+  memset(mSlots, 0, sizeof(mSlots));
+
+  // Hand out low slots first.
+  for (size_t i = 0; i < MAX_REQUESTS; i++) {
+    mFreeList[i] = MAX_REQUESTS - 1 - i;
+    mSlots[i].generation = 1;
+  }
+}
+
+WifiRequestTable::~WifiRequestTable()
+{
+}
+
+WifiRequestId
+WifiRequestTable::add(uint32_t aConnId, uint16_t aSessionId, uint16_t aMsgType)
+{
+  uint16_t index;
+  Slot* slot;
+
+  if (mFreeCount == 0) {
+    return WIFI_REQUEST_ID_INVALID;
+  }
+
+  index = mFreeList[--mFreeCount];
+  slot = &mSlots[index];
+
+  slot->req.connId = aConnId;
+  slot->req.sessionId = aSessionId;
+  slot->req.msgType = aMsgType;
+  slot->req.startTime = WifiStats::getTime();
+  slot->req.batchId = WIFI_REQUEST_ID_INVALID;
+  slot->inUse = true;
+  mCount++;
+
+  return (static_cast<uint32_t>(slot->generation) << INDEX_BITS) | index;
+}
+
+struct WifiRequest*
+WifiRequestTable::get(WifiRequestId aId)
+{
+  uint32_t index = aId & INDEX_MASK;
+  Slot* slot;
+
+  if (index >= MAX_REQUESTS) {
+    return NULL;
+  }
+
+  slot = &mSlots[index];
+
+  if (!slot->inUse || slot->generation != (aId >> INDEX_BITS)) {
+    return NULL;
+  }
+
+  return &slot->req;
+}
+
+void
+WifiRequestTable::remove(WifiRequestId aId)
+{
+  uint32_t index = aId & INDEX_MASK;
+
+  if (!get(aId)) {
+    return;
+  }
+
+  mSlots[index].inUse = false;
+  // Generation 0 would make a valid id of slot 0 equal to
+  // WIFI_REQUEST_ID_INVALID.
+  if (++mSlots[index].generation == 0) {
+    mSlots[index].generation = 1;
+  }
+  mFreeList[mFreeCount++] = index;
+  mCount--;
+}
+
+void
+WifiRequestTable::removeConnection(uint32_t aConnId)
+{
+  for (size_t i = 0; i < MAX_REQUESTS; i++) {
+    Slot* slot = &mSlots[i];
+
+    if (slot->inUse && slot->req.connId == aConnId) {
+      remove((static_cast<uint32_t>(slot->generation) << INDEX_BITS) | i);
+    }
+  }
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiRequestTable_h
+#define WifiRequestTable_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Identifies one in-flight request inside the daemon. 0 is never valid.
+typedef uint32_t WifiRequestId;
+
+#define WIFI_REQUEST_ID_INVALID 0
+
+struct WifiRequest {
+  uint32_t connId;
+  uint16_t sessionId;
+  uint16_t msgType;
+  uint64_t startTime;   // monotonic microseconds when received
+  WifiRequestId batchId;  // the BATCH request carrying this one, if any
+};
+
+/**
+ * Fixed-size table of in-flight requests. Each request gets a slot when it
+ * is received and is completed through the id of that slot, so requests
+ * finish in any order and lookups are a single array access. Slots are
+ * preallocated and recycled through a free list.
+ *
+ * The low bits of an id select the slot and the high bits carry the slot's
+ * generation, so a stale id of a recycled slot is rejected.
+ */
+class WifiRequestTable
+{
+public:
+  static const size_t MAX_REQUESTS = 256;
+
+  WifiRequestTable();
+  ~WifiRequestTable();
+
+  // Returns WIFI_REQUEST_ID_INVALID if the table is full.
+  WifiRequestId add(uint32_t aConnId, uint16_t aSessionId, uint16_t aMsgType);
+
+  // Returns NULL if the id is unknown or already completed.
+  struct WifiRequest* get(WifiRequestId aId);
+
+  void remove(WifiRequestId aId);
+
+  // Returns the request in slot aIndex, or NULL if the slot is free.
+  struct WifiRequest* getAt(size_t aIndex)
+  {
+    return mSlots[aIndex].inUse ? &mSlots[aIndex].req : NULL;
+  }
+
+  // Drops every request of a closed connection.
+  void removeConnection(uint32_t aConnId);
+
+  size_t size()
+  {
+    return mCount;
+  }
+
+private:
+  struct Slot {
+    struct WifiRequest req;
+    uint16_t generation;
+    bool inUse;
+  };
+
+  static const uint32_t INDEX_BITS = 16;
+  static const uint32_t INDEX_MASK = (1 << INDEX_BITS) - 1;
+
+  Slot mSlots[MAX_REQUESTS];
+  uint16_t mFreeList[MAX_REQUESTS];
+  size_t mFreeCount;
+  size_t mCount;
+};
+
+#endif // WifiRequestTable_h
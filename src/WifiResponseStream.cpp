@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+
+#include "WifiDebug.h"
+#include "WifiMessageHandler.h"
+#include "WifiResponseStream.h"
+
+WifiResponseStream::WifiResponseStream(uint16_t aSessionId, uint16_t aMsgType,
+  WifiStreamSource* aSource)
+  : mSessionId(aSessionId)
+  , mMsgType(aMsgType)
+  , mSource(aSource)
+  , mDone(false)
+{
+  assert(aSource);
+}
+
+WifiResponseStream::~WifiResponseStream()
+{
+  delete mSource;
+}
+
+ssize_t
+WifiResponseStream::nextFrame(uint8_t* aBuf, size_t aBufLen)
+{
+  struct WifiMsgResp* resp = reinterpret_cast<struct WifiMsgResp*>(aBuf);
+  uint16_t status = WIFI_STATUS_OK;
+  ssize_t length;
+
+  assert(aBufLen > sizeof(*resp));
+
+  if (mDone) {
+    return 0;
+  }
+
+  length = mSource->read(aBuf + sizeof(*resp), aBufLen - sizeof(*resp));
+
+  if (length < 0) {
+    // Tell the client to drop what it got so far.
+    WIFID_WARNING("Session %u: Response data is gone, abort the stream.",
+      mSessionId);
+    length = 0;
+    status = WIFI_STATUS_ERROR;
+    mDone = true;
+  } else {
+    mDone = mSource->isDone();
+  }
+
+  WifiMsgInitHeader(&resp->hdr, WIFI_MESSAGE_RESPONSE,
+    mMsgType | (mDone ? 0 : WIFI_MESSAGE_FLAG_MORE), sizeof(*resp) + length);
+  resp->sessionId = mSessionId;
+  resp->status = status;
+
+  return sizeof(*resp) + length;
+}
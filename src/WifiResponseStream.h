@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiResponseStream_h
+#define WifiResponseStream_h
+
+#include <stdint.h>
+
+#include "WifiIpcConnection.h"
+#include "WifiStreamSource.h"
+
+/**
+ * Frames the data of a source as a chunked response. Each chunk is read
+ * from the source only when the connection asks for the next frame, so
+ * at most one chunk of the response is held in memory.
+ */
+class WifiResponseStream
+  : public WifiOutStream
+{
+public:
+  // Takes the ownership of aSource.
+  WifiResponseStream(uint16_t aSessionId, uint16_t aMsgType,
+                     WifiStreamSource* aSource);
+  ~WifiResponseStream();
+
+  ssize_t nextFrame(uint8_t* aBuf, size_t aBufLen);
+
+private:
+  uint16_t mSessionId;
+  uint16_t mMsgType;
+  WifiStreamSource* mSource;
+  bool mDone;
+};
+
+#endif // WifiResponseStream_h
@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "WifiDebug.h"
+#include "WifiScanResults.h"
+
+#define SCAN_RESULTS_CMD "SCAN_RESULTS"
+#define SCAN_RESULTS_HEADER "bssid / frequency / signal level / flags / ssid\n"
+#define IFNAME_PREFIX "IFNAME="
+
+// "xx:xx:xx:xx:xx:xx\t" + "65535\t" + "-32768\t" + NUL
+#define MAX_FIXED_LINE_LEN (18 + 6 + 7 + 1)
+
+static size_t
+trimCommand(const char* aCmd, size_t aLen)
+{
+  // Clients may send the terminating NUL or a newline along.
+  while (aLen > 0 && (aCmd[aLen - 1] == '\0' || aCmd[aLen - 1] == '\n')) {
+    aLen--;
+  }
+
+  return aLen;
+}
+
+WifiScanResults::WifiScanResults()
+  : mValid(false)
+  , mGeneration(0)
+{
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+bool
+WifiScanResults::isScanResultsCommand(const char* aCmd, size_t aLen)
+{
+  const char* space;
+
+  aLen = trimCommand(aCmd, aLen);
+
+  if (aLen > strlen(IFNAME_PREFIX) &&
+      !strncmp(aCmd, IFNAME_PREFIX, strlen(IFNAME_PREFIX))) {
+    space = static_cast<const char*>(memchr(aCmd, ' ', aLen));
+    if (!space) {
+      return false;
+    }
+    aLen -= space + 1 - aCmd;
+    aCmd = space + 1;
+  }
+
+  return aLen == strlen(SCAN_RESULTS_CMD) &&
+    !strncmp(aCmd, SCAN_RESULTS_CMD, aLen);
+}
+
+bool
+WifiScanResults::lookup(const char* aCmd, size_t aLen)
+{
+  aLen = trimCommand(aCmd, aLen);
+
+  if (mValid && mCommand.compare(0, std::string::npos, aCmd, aLen) == 0) {
+    mStats.hits++;
+    return true;
+  }
+
+  mStats.misses++;
+  return false;
+}
+
+int
+WifiScanResults::fill(uint32_t aGeneration, const char* aCmd, size_t aCmdLen,
+  const char* aReply, size_t aReplyLen)
+{
+  const char* line;
+  const char* end = aReply + aReplyLen;
+  const char* eol;
+  std::string text;
+  size_t cursor = 0;
+
+  if (aGeneration != mGeneration) {
+    // A newer scan completed while the command was in flight.
+    return -1;
+  }
+
+  clear();
+
+  if (aReplyLen < strlen(SCAN_RESULTS_HEADER) ||
+      strncmp(aReply, SCAN_RESULTS_HEADER, strlen(SCAN_RESULTS_HEADER))) {
+    return -1;
+  }
+
+  for (line = aReply + strlen(SCAN_RESULTS_HEADER); line < end; line = eol + 1) {
+    eol = static_cast<const char*>(memchr(line, '\n', end - line));
+    if (!eol || size() == MAX_BSS || parseLine(line, eol - line) < 0) {
+      clear();
+      return -1;
+    }
+  }
+
+  // Only cache what rebuilds to the very same text.
+  text.resize(getReplyLength());
+  if (text.size() != aReplyLen ||
+      serialize(&text[0], text.size(), &cursor) != aReplyLen ||
+      memcmp(text.data(), aReply, aReplyLen)) {
+    WIFID_DEBUG("Scan results do not round-trip, not cached.");
+    clear();
+    return -1;
+  }
+
+  mCommand.assign(aCmd, trimCommand(aCmd, aCmdLen));
+  mValid = true;
+  mStats.fills++;
+
+  return 0;
+}
+
+void
+WifiScanResults::invalidate()
+{
+  if (mValid) {
+    mStats.invalidations++;
+  }
+
+  // Replies of commands sent before now are stale.
+  clear();
+}
+
+size_t
+WifiScanResults::getReplyLength()
+{
+  size_t len = strlen(SCAN_RESULTS_HEADER);
+  char num[8];
+
+  for (size_t i = 0; i < size(); i++) {
+    len += 3 * BSSID_LEN;
+    len += snprintf(num, sizeof(num), "%u\t", mFreqs[i]);
+    len += snprintf(num, sizeof(num), "%d\t", mRssis[i]);
+    len += mFlagSets[mFlags[i]].size() + 1;
+    len += mSsidLens[i] + 1;
+  }
+
+  return len;
+}
+
+size_t
+WifiScanResults::serialize(char* aBuf, size_t aBufLen, size_t* aCursor)
+{
+  size_t len = 0;
+  const uint8_t* bssid;
+  const std::string* flags;
+  char fixed[MAX_FIXED_LINE_LEN];
+  size_t fixedLen;
+  size_t i;
+
+  assert(aCursor);
+
+  if (*aCursor == 0) {
+    if (aBufLen < strlen(SCAN_RESULTS_HEADER)) {
+      return 0;
+    }
+    len = strlen(SCAN_RESULTS_HEADER);
+    memcpy(aBuf, SCAN_RESULTS_HEADER, len);
+    (*aCursor)++;
+  }
+
+  // Line n of the reply, after the header, is the BSS n - 1.
+  for (; *aCursor <= size(); (*aCursor)++) {
+    i = *aCursor - 1;
+    flags = &mFlagSets[mFlags[i]];
+    bssid = &mBssids[i * BSSID_LEN];
+
+    fixedLen = snprintf(fixed, sizeof(fixed),
+      "%02x:%02x:%02x:%02x:%02x:%02x\t%u\t%d\t",
+      bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5],
+      mFreqs[i], mRssis[i]);
+
+    if (aBufLen - len < fixedLen + flags->size() + mSsidLens[i] + 2) {
+      break;
+    }
+
+    memcpy(aBuf + len, fixed, fixedLen);
+    len += fixedLen;
+
+    memcpy(aBuf + len, flags->data(), flags->size());
+    len += flags->size();
+    aBuf[len++] = '\t';
+
+    memcpy(aBuf + len, mSsids.data() + mSsidOffsets[i], mSsidLens[i]);
+    len += mSsidLens[i];
+    aBuf[len++] = '\n';
+  }
+
+  return len;
+}
+
+void
+WifiScanResults::getStats(struct WifiScanResultsStats* aStats)
+{
+  *aStats = mStats;
+}
+
+void
+WifiScanResults::clear()
+{
+  // Streams still reading the old table must stop.
+  mGeneration++;
+
+  mValid = false;
+  mCommand.clear();
+  mBssids.clear();
+  mFreqs.clear();
+  mRssis.clear();
+  mFlags.clear();
+  mSsidOffsets.clear();
+  mSsidLens.clear();
+  mFlagSets.clear();
+  mSsids.clear();
+}
+
+int
+WifiScanResults::parseLine(const char* aLine, size_t aLen)
+{
+  const char* field[5];
+  size_t fieldLen[5];
+  const char* p = aLine;
+  const char* end = aLine + aLen;
+  const char* tab;
+  unsigned int bssid[BSSID_LEN];
+  char num[8];
+  long freq;
+  long rssi;
+  int flags;
+  char* numEnd;
+
+  // bssid, frequency, signal level and flags are tab terminated, the
+  // ssid takes the rest of the line.
+  for (int i = 0; i < 4; i++) {
+    tab = static_cast<const char*>(memchr(p, '\t', end - p));
+    if (!tab) {
+      return -1;
+    }
+    field[i] = p;
+    fieldLen[i] = tab - p;
+    p = tab + 1;
+  }
+  field[4] = p;
+  fieldLen[4] = end - p;
+
+  if (fieldLen[0] != 3 * BSSID_LEN - 1 ||
+      sscanf(field[0], "%2x:%2x:%2x:%2x:%2x:%2x", &bssid[0], &bssid[1],
+        &bssid[2], &bssid[3], &bssid[4], &bssid[5]) != BSSID_LEN) {
+    return -1;
+  }
+
+  if (fieldLen[1] == 0 || fieldLen[1] >= sizeof(num)) {
+    return -1;
+  }
+  memcpy(num, field[1], fieldLen[1]);
+  num[fieldLen[1]] = '\0';
+  freq = strtol(num, &numEnd, 10);
+  if (*numEnd || freq < 0 || freq > UINT16_MAX) {
+    return -1;
+  }
+
+  if (fieldLen[2] == 0 || fieldLen[2] >= sizeof(num)) {
+    return -1;
+  }
+  memcpy(num, field[2], fieldLen[2]);
+  num[fieldLen[2]] = '\0';
+  rssi = strtol(num, &numEnd, 10);
+  if (*numEnd || rssi < INT16_MIN || rssi > INT16_MAX) {
+    return -1;
+  }
+
+  if (fieldLen[3] > UINT8_MAX || fieldLen[4] > UINT8_MAX) {
+    return -1;
+  }
+
+  flags = internFlags(field[3], fieldLen[3]);
+  if (flags < 0) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < BSSID_LEN; i++) {
+    mBssids.push_back(bssid[i]);
+  }
+  mFreqs.push_back(freq);
+  mRssis.push_back(rssi);
+  mFlags.push_back(flags);
+  mSsidOffsets.push_back(mSsids.size());
+  mSsidLens.push_back(fieldLen[4]);
+  mSsids.append(field[4], fieldLen[4]);
+
+  return 0;
+}
+
+int
+WifiScanResults::internFlags(const char* aFlags, size_t aLen)
+{
+  for (size_t i = 0; i < mFlagSets.size(); i++) {
+    if (mFlagSets[i].compare(0, std::string::npos, aFlags, aLen) == 0) {
+      return i;
+    }
+  }
+
+  if (mFlagSets.size() > UINT8_MAX) {
+    return -1;
+  }
+
+  mFlagSets.push_back(std::string(aFlags, aLen));
+
+  return mFlagSets.size() - 1;
+}
+
+WifiScanResultsSource::WifiScanResultsSource(WifiScanResults* aScanResults)
+  : mScanResults(aScanResults)
+  , mGeneration(aScanResults->getGeneration())
+  , mCursor(0)
+{
+}
+
+ssize_t
+WifiScanResultsSource::read(uint8_t* aBuf, size_t aLen)
+{
+  size_t len;
+
+  if (mScanResults->getGeneration() != mGeneration) {
+    // A new scan replaced the table while the reply was streamed.
+    return -1;
+  }
+
+  len = mScanResults->serialize(reinterpret_cast<char*>(aBuf), aLen, &mCursor);
+
+  if (len == 0 && !isDone()) {
+    return -1;
+  }
+
+  return len;
+}
+
+bool
+WifiScanResultsSource::isDone()
+{
+  return mCursor > mScanResults->size();
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiScanResults_h
+#define WifiScanResults_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#include "WifiStreamSource.h"
+
+struct WifiScanResultsStats {
+  uint32_t hits;      // answered from the table
+  uint32_t misses;    // forwarded to the supplicant
+  uint32_t fills;
+  uint32_t invalidations;
+};
+
+/**
+ * Cache of the last SCAN_RESULTS reply of the supplicant.
+ *
+ * The reply is parsed into a BSS table kept as one array per column, so
+ * the table costs a few bytes per BSS instead of a text line. Flag sets
+ * repeat across BSSs and are stored once. The reply text is rebuilt from
+ * the table, a chunk at a time, for every hit until a new scan
+ * invalidates it.
+ *
+ * Only used from the thread running WifiIpcManager::loop().
+ */
+class WifiScanResults
+{
+public:
+  static const size_t BSSID_LEN = 6;
+  static const size_t MAX_BSS = 512;
+
+  WifiScanResults();
+
+  // Whether aCmd is the SCAN_RESULTS command, with or without an
+  // IFNAME= prefix.
+  static bool isScanResultsCommand(const char* aCmd, size_t aLen);
+
+  // Whether the table holds the results for the command aCmd.
+  bool lookup(const char* aCmd, size_t aLen);
+
+  // Returns the generation to pass to fill() for the reply of a command
+  // sent now. It changes whenever the table is cleared or refilled.
+  uint32_t getGeneration()
+  {
+    return mGeneration;
+  }
+
+  // Parses the reply of aCmd into the table. The reply is dropped if the
+  // table was invalidated since aGeneration or if it does not parse.
+  int fill(uint32_t aGeneration, const char* aCmd, size_t aCmdLen,
+           const char* aReply, size_t aReplyLen);
+
+  void invalidate();
+
+  // Size of the reply text rebuilt by serialize().
+  size_t getReplyLength();
+
+  // Rebuilds the reply text from the line at aCursor on, as many whole
+  // lines as fit in aBuf, and moves aCursor past them. Start with 0.
+  size_t serialize(char* aBuf, size_t aBufLen, size_t* aCursor);
+
+  size_t size()
+  {
+    return mFreqs.size();
+  }
+
+  void getStats(struct WifiScanResultsStats* aStats);
+
+private:
+  void clear();
+  int parseLine(const char* aLine, size_t aLen);
+  // Returns the index of the flag set, or -1 if there are too many.
+  int internFlags(const char* aFlags, size_t aLen);
+
+  bool mValid;
+  uint32_t mGeneration;
+  std::string mCommand;
+
+  // One entry per BSS in every array.
+  std::vector<uint8_t> mBssids;         // BSSID_LEN bytes per BSS
+  std::vector<uint16_t> mFreqs;         // MHz
+  std::vector<int16_t> mRssis;          // dBm
+  std::vector<uint8_t> mFlags;          // index into mFlagSets
+  std::vector<uint32_t> mSsidOffsets;   // into mSsids
+  std::vector<uint8_t> mSsidLens;
+
+  std::vector<std::string> mFlagSets;
+  std::string mSsids;
+
+  struct WifiScanResultsStats mStats;
+};
+
+/**
+ * Streams the reply text of a WifiScanResults table. Fails if the table
+ * is invalidated before the whole reply is read.
+ */
+class WifiScanResultsSource
+  : public WifiStreamSource
+{
+public:
+  WifiScanResultsSource(WifiScanResults* aScanResults);
+
+  ssize_t read(uint8_t* aBuf, size_t aLen);
+  bool isDone();
+
+private:
+  WifiScanResults* mScanResults;
+  uint32_t mGeneration;
+  size_t mCursor;
+};
+
+#endif // WifiScanResults_h
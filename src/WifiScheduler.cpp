@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "WifiScheduler.h"
+#include "WifiStats.h"
+
+WifiScheduler::WifiScheduler()
+  : mQueuedBytes(0)
+{
+  memset(mInFlight, 0, sizeof(mInFlight));
+  memset(mBypasses, 0, sizeof(mBypasses));
+  memset(mStats, 0, sizeof(mStats));
+}
+
+bool
+WifiScheduler::admit(WifiPriority aPriority)
+{
+  size_t shared = mInFlight[WIFI_PRIORITY_INTERACTIVE] +
+                  mInFlight[WIFI_PRIORITY_BULK];
+
+  if (aPriority != WIFI_PRIORITY_CONTROL) {
+    // Requests of a class run in order, and none ahead of a higher class
+    // already waiting.
+    for (int p = WIFI_PRIORITY_INTERACTIVE; p <= aPriority; p++) {
+      if (!mQueues[p].empty()) {
+        return false;
+      }
+    }
+
+    if (shared >= MAX_IN_FLIGHT) {
+      return false;
+    }
+  }
+
+  mInFlight[aPriority]++;
+  mStats[aPriority].admitted++;
+
+  return true;
+}
+
+void
+WifiScheduler::charge(WifiPriority aPriority)
+{
+  mInFlight[aPriority]++;
+}
+
+int
+WifiScheduler::enqueue(WifiPriority aPriority, uint32_t aConnId,
+  const uint8_t* aData, size_t aLength)
+{
+  std::deque<Waiting>& queue = mQueues[aPriority];
+  struct WifiSchedulerStats& stats = mStats[aPriority];
+  size_t& queued = mQueuedByConnection[aConnId];
+
+  if (queue.size() >= MAX_QUEUED || queued >= MAX_QUEUED_PER_CONNECTION ||
+      mQueuedBytes + aLength > MAX_QUEUED_BYTES) {
+    if (queued == 0) {
+      mQueuedByConnection.erase(aConnId);
+    }
+    stats.rejected++;
+    return -1;
+  }
+
+  queued++;
+  mQueuedBytes += aLength;
+
+  queue.push_back(Waiting());
+  queue.back().connId = aConnId;
+  queue.back().time = WifiStats::getTime();
+  queue.back().data.assign(reinterpret_cast<const char*>(aData), aLength);
+
+  stats.depth = queue.size();
+  if (stats.depth > stats.maxDepth) {
+    stats.maxDepth = stats.depth;
+  }
+
+  return 0;
+}
+
+bool
+WifiScheduler::next(uint32_t* aConnId, std::string* aData)
+{
+  int chosen = -1;
+  uint64_t wait;
+
+  if (mInFlight[WIFI_PRIORITY_INTERACTIVE] + mInFlight[WIFI_PRIORITY_BULK] >=
+      MAX_IN_FLIGHT) {
+    return false;
+  }
+
+  // Control requests never wait, the others take turns.
+  for (int p = WIFI_PRIORITY_INTERACTIVE; p < WIFI_PRIORITY_COUNT; p++) {
+    if (mQueues[p].empty()) {
+      continue;
+    }
+    if (chosen < 0) {
+      chosen = p;
+    } else if (mBypasses[p] >= MAX_BYPASSES) {
+      // Starved long enough.
+      chosen = p;
+      break;
+    }
+  }
+
+  if (chosen < 0) {
+    return false;
+  }
+
+  for (int p = chosen + 1; p < WIFI_PRIORITY_COUNT; p++) {
+    if (!mQueues[p].empty()) {
+      mBypasses[p]++;
+    }
+  }
+  mBypasses[chosen] = 0;
+
+  std::deque<Waiting>& queue = mQueues[chosen];
+  struct WifiSchedulerStats& stats = mStats[chosen];
+
+  *aConnId = queue.front().connId;
+  aData->swap(queue.front().data);
+  mQueuedBytes -= aData->size();
+  if (--mQueuedByConnection[*aConnId] == 0) {
+    mQueuedByConnection.erase(*aConnId);
+  }
+  wait = WifiStats::getTime() - queue.front().time;
+  queue.pop_front();
+
+  stats.depth = queue.size();
+  stats.queued++;
+  if (wait > stats.maxWait) {
+    stats.maxWait = wait;
+  }
+
+  mInFlight[chosen]++;
+
+  return true;
+}
+
+void
+WifiScheduler::done(WifiPriority aPriority)
+{
+  if (mInFlight[aPriority] > 0) {
+    mInFlight[aPriority]--;
+  }
+}
+
+void
+WifiScheduler::removeConnection(uint32_t aConnId)
+{
+  for (int p = 0; p < WIFI_PRIORITY_COUNT; p++) {
+    std::deque<Waiting>& queue = mQueues[p];
+    std::deque<Waiting>::iterator it = queue.begin();
+
+    while (it != queue.end()) {
+      if (it->connId == aConnId) {
+        mQueuedBytes -= it->data.size();
+        it = queue.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    mStats[p].depth = queue.size();
+  }
+
+  mQueuedByConnection.erase(aConnId);
+}
+
+void
+WifiScheduler::getStats(WifiPriority aPriority,
+  struct WifiSchedulerStats* aStats)
+{
+  *aStats = mStats[aPriority];
+}
+
+void
+WifiScheduler::report(std::string* aOut)
+{
+  static const char* sNames[] = { "control", "interactive", "bulk" };
+  char line[192];
+
+  for (int p = 0; p < WIFI_PRIORITY_COUNT; p++) {
+    const struct WifiSchedulerStats& stats = mStats[p];
+
+    snprintf(line, sizeof(line), "priority %s inflight %zu depth %u "
+      "max_depth %u admitted %u queued %u rejected %u max_wait %" PRIu64
+      "us\n", sNames[p], mInFlight[p], stats.depth, stats.maxDepth,
+      stats.admitted, stats.queued, stats.rejected, stats.maxWait);
+    aOut->append(line);
+  }
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiScheduler_h
+#define WifiScheduler_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <map>
+#include <string>
+
+/**
+ * Scheduling classes of the requests, highest first.
+ */
+typedef enum {
+  WIFI_PRIORITY_CONTROL,        // turning WiFi on and off, never waits
+  WIFI_PRIORITY_INTERACTIVE,    // answered by the daemon itself
+  WIFI_PRIORITY_BULK,           // supplicant commands
+  WIFI_PRIORITY_COUNT
+} WifiPriority;
+
+struct WifiSchedulerStats {
+  uint32_t depth;               // requests waiting now
+  uint32_t maxDepth;
+  uint32_t admitted;            // run without waiting
+  uint32_t queued;              // run after waiting
+  uint32_t rejected;            // refused, the queue or the share of the
+                                // connection was full
+  uint64_t maxWait;             // microseconds
+};
+
+/**
+ * Decides when the requests received run.
+ *
+ * Control requests always run at once. Interactive and bulk requests
+ * share MAX_IN_FLIGHT places, so a flood of commands can neither fill the
+ * request table nor keep the supplicant busy ahead of a control request.
+ * Once the places are taken, requests wait in a queue per class and the
+ * next free place goes to the highest class waiting, unless a lower class
+ * was passed over MAX_BYPASSES times in a row.
+ *
+ * The requests of a batch run in the place of the batch but are charged
+ * too, so no new request is admitted until they are over. With at most
+ * WIFI_BATCH_MAX_REQUESTS of them, interactive and bulk requests never
+ * hold more than MAX_IN_FLIGHT + WIFI_BATCH_MAX_REQUESTS slots of the
+ * request table, the rest is left to control requests.
+ *
+ * A connection has at most MAX_QUEUED_PER_CONNECTION requests waiting
+ * and all of them take at most MAX_QUEUED_BYTES, so one client can not
+ * crowd the others out of the queues.
+ *
+ * Only used from the thread running WifiIpcManager::loop().
+ */
+class WifiScheduler
+{
+public:
+  static const size_t MAX_IN_FLIGHT = 64;
+  static const size_t MAX_QUEUED = 1024;
+  static const size_t MAX_QUEUED_PER_CONNECTION = 32;
+  static const size_t MAX_QUEUED_BYTES = 4 * 1024 * 1024;
+  static const uint32_t MAX_BYPASSES = 8;
+
+  WifiScheduler();
+
+  // Whether a request of aPriority may run now. If so, it holds a place
+  // until done() is called.
+  bool admit(WifiPriority aPriority);
+
+  // Holds a place for a request run as part of an admitted one, even if
+  // none is free.
+  void charge(WifiPriority aPriority);
+
+  // Keeps a copy of the request aData of aConnId until it may run.
+  // Returns -1 if the queue of aPriority, or the share of aConnId, is
+  // full.
+  int enqueue(WifiPriority aPriority, uint32_t aConnId, const uint8_t* aData,
+              size_t aLength);
+
+  // Takes the next waiting request that may run now, holding a place for
+  // it. Returns false if there is none.
+  bool next(uint32_t* aConnId, std::string* aData);
+
+  // Gives the place of a finished request back.
+  void done(WifiPriority aPriority);
+
+  // Drops the waiting requests of a closed connection.
+  void removeConnection(uint32_t aConnId);
+
+  void getStats(WifiPriority aPriority, struct WifiSchedulerStats* aStats);
+  void report(std::string* aOut);
+
+private:
+  struct Waiting {
+    uint32_t connId;
+    uint64_t time;              // monotonic microseconds when queued
+    std::string data;
+  };
+
+  std::deque<Waiting> mQueues[WIFI_PRIORITY_COUNT];
+  size_t mInFlight[WIFI_PRIORITY_COUNT];
+  uint32_t mBypasses[WIFI_PRIORITY_COUNT];
+  // Waiting requests by connection, and the bytes they take.
+  std::map<uint32_t, size_t> mQueuedByConnection;
+  size_t mQueuedBytes;
+
+  struct WifiSchedulerStats mStats[WIFI_PRIORITY_COUNT];
+};
+
+#endif // WifiScheduler_h
@@ -0,0 +1,636 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "WifiDebug.h"
+#include "WifiShmIpcHandler.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+static int
+createMemFd(const char* aName)
+{
+#ifdef __NR_memfd_create
+  return syscall(__NR_memfd_create, aName, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+WifiShmIpcHandler::WifiShmIpcHandler(IpcHandler* aSocket, bool aIsDaemon)
+  : mSocket(aSocket)
+  , mOwnsSocket(false)
+  , mIsDaemon(aIsDaemon)
+  , mIsConnected(false)
+  , mEpollFd(-1)
+  , mRegion(NULL)
+  , mRegionSize(0)
+  , mRingSize(0)
+  , mRx(NULL)
+  , mRxData(NULL)
+  , mTx(NULL)
+  , mTxData(NULL)
+{
+  assert(aSocket);
+
+  for (int i = 0; i < NUM_FDS; i++) {
+    mFds[i] = -1;
+  }
+}
+
+WifiShmIpcHandler::~WifiShmIpcHandler()
+{
+  closeIpc();
+
+  if (mOwnsSocket) {
+    delete mSocket;
+  }
+}
+
+WifiShmIpcHandler*
+WifiShmIpcHandler::create(IpcHandler* aSocket)
+{
+  WifiShmIpcHandler* handler = new WifiShmIpcHandler(aSocket, true);
+  size_t size = WIFI_SHM_DATA_OFFSET + 2 * RING_SIZE;
+
+  handler->mFds[FD_MEMFD] = createMemFd("wifid_shm");
+  if (handler->mFds[FD_MEMFD] < 0) {
+    WIFID_WARNING("Shared memory is not supported: %s", strerror(errno));
+    delete handler;
+    return NULL;
+  }
+
+  // A new memfd reads as zeros, both rings start empty.
+  if (ftruncate(handler->mFds[FD_MEMFD], size) < 0) {
+    WIFID_ERROR("Could not size the shared region: %s", strerror(errno));
+    delete handler;
+    return NULL;
+  }
+
+  // A client shrinking the region would kill the daemon with SIGBUS.
+  if (fcntl(handler->mFds[FD_MEMFD], F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+    WIFID_WARNING("Could not seal the shared region: %s", strerror(errno));
+    delete handler;
+    return NULL;
+  }
+
+  handler->mFds[FD_CLIENT_EVENT] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  handler->mFds[FD_DAEMON_EVENT] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (handler->mFds[FD_CLIENT_EVENT] < 0 || handler->mFds[FD_DAEMON_EVENT] < 0) {
+    WIFID_ERROR("Could not create eventfd: %s", strerror(errno));
+    delete handler;
+    return NULL;
+  }
+
+  if (handler->init(RING_SIZE) < 0) {
+    delete handler;
+    return NULL;
+  }
+
+  // Both sides start asleep, the first message must wake its reader.
+  handler->mRx->readerWaiting = 1;
+  handler->mTx->readerWaiting = 1;
+
+  return handler;
+}
+
+WifiShmIpcHandler*
+WifiShmIpcHandler::attach(IpcHandler* aSocket, const int* aFds,
+  uint32_t aRingSize)
+{
+  WifiShmIpcHandler* handler = new WifiShmIpcHandler(aSocket, false);
+
+  for (int i = 0; i < NUM_FDS; i++) {
+    handler->mFds[i] = aFds[i];
+  }
+
+  if (handler->init(aRingSize) < 0) {
+    delete handler;
+    return NULL;
+  }
+
+  return handler;
+}
+
+int
+WifiShmIpcHandler::init(uint32_t aRingSize)
+{
+  struct epoll_event ev;
+  int eventFd = mFds[mIsDaemon ? FD_DAEMON_EVENT : FD_CLIENT_EVENT];
+  uint8_t* requests;
+  uint8_t* responses;
+
+  // Offsets are wrapped with a mask.
+  if (aRingSize == 0 || (aRingSize & (aRingSize - 1))) {
+    WIFID_ERROR("Invalid ring size %u.", aRingSize);
+    return -1;
+  }
+
+  for (int i = 0; i < NUM_FDS; i++) {
+    if (mFds[i] < 0) {
+      WIFID_ERROR("Missing shared memory descriptor %d.", i);
+      return -1;
+    }
+  }
+
+  mRegionSize = WIFI_SHM_DATA_OFFSET + 2 * static_cast<size_t>(aRingSize);
+  mRegion = static_cast<uint8_t*>(mmap(NULL, mRegionSize,
+    PROT_READ | PROT_WRITE, MAP_SHARED, mFds[FD_MEMFD], 0));
+  if (mRegion == MAP_FAILED) {
+    WIFID_ERROR("Could not map the shared region: %s", strerror(errno));
+    mRegion = NULL;
+    return -1;
+  }
+  mRingSize = aRingSize;
+
+  requests = mRegion + WIFI_SHM_DATA_OFFSET;
+  responses = requests + aRingSize;
+
+  if (mIsDaemon) {
+    mRx = reinterpret_cast<struct WifiShmRing*>(mRegion);
+    mRxData = requests;
+    mTx = reinterpret_cast<struct WifiShmRing*>(mRegion + WIFI_SHM_RING_HEADER_SIZE);
+    mTxData = responses;
+  } else {
+    mRx = reinterpret_cast<struct WifiShmRing*>(mRegion + WIFI_SHM_RING_HEADER_SIZE);
+    mRxData = responses;
+    mTx = reinterpret_cast<struct WifiShmRing*>(mRegion);
+    mTxData = requests;
+  }
+
+  mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (mEpollFd < 0) {
+    WIFID_ERROR("Could not create epoll: %s", strerror(errno));
+    return -1;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, eventFd, &ev) < 0) {
+    WIFID_ERROR("Could not watch eventfd: %s", strerror(errno));
+    return -1;
+  }
+
+  // The socket only reports the hang-up of the peer from now on.
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mSocket->getFd(), &ev) < 0) {
+    WIFID_ERROR("Could not watch socket: %s", strerror(errno));
+    return -1;
+  }
+
+  mIsConnected = true;
+
+  return 0;
+}
+
+int
+WifiShmIpcHandler::sendHandshake(const uint8_t* aFrame, size_t aLength)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  char control[CMSG_SPACE(NUM_FDS * sizeof(int))];
+  struct cmsghdr* cmsg;
+  ssize_t size;
+
+  if (!mIsConnected) {
+    return -1;
+  }
+
+  iov.iov_base = const_cast<uint8_t*>(aFrame);
+  iov.iov_len = aLength;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(NUM_FDS * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), mFds, NUM_FDS * sizeof(int));
+
+  // Runs on the loop thread, a peer not reading must not stall it.
+  size = TEMP_FAILURE_RETRY(
+    sendmsg(mSocket->getFd(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT));
+
+  if (size < 0) {
+    WIFID_ERROR("Could not send the shared memory handshake: %s", strerror(errno));
+    return -1;
+  }
+
+  // A packet socket takes the frame whole or not at all.
+  if (static_cast<size_t>(size) < aLength) {
+    WIFID_ERROR("Shared memory handshake cut after %zd bytes.", size);
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+WifiShmIpcHandler::recvHandshake(int aFd, uint8_t* aBuf, size_t aLength,
+  int* aFds)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  char control[CMSG_SPACE(NUM_FDS * sizeof(int))];
+  struct cmsghdr* cmsg;
+  ssize_t size;
+
+  for (int i = 0; i < NUM_FDS; i++) {
+    aFds[i] = -1;
+  }
+
+  iov.iov_base = aBuf;
+  iov.iov_len = aLength;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  size = TEMP_FAILURE_RETRY(recvmsg(aFd, &msg, MSG_CMSG_CLOEXEC));
+  if (size <= 0) {
+    return size;
+  }
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(NUM_FDS * sizeof(int))) {
+      memcpy(aFds, CMSG_DATA(cmsg), NUM_FDS * sizeof(int));
+    }
+  }
+
+  return size;
+}
+
+int
+WifiShmIpcHandler::openIpc()
+{
+  // Set up by create() or attach().
+  return mIsConnected ? 0 : -1;
+}
+
+int
+WifiShmIpcHandler::readIpc(uint8_t* aData, size_t aDataLen)
+{
+  int size;
+
+  if (!mIsConnected) {
+    return -1;
+  }
+
+  size = readRing(aData, aDataLen);
+  if (size != 0) {
+    return size;
+  }
+
+  // Going to sleep. Clear the pending wake-up first so a message written
+  // after the check below still wakes us.
+  drainEvent();
+  mRx->readerWaiting = 1;
+  __sync_synchronize();
+
+  size = readRing(aData, aDataLen);
+  if (size != 0) {
+    return size;
+  }
+
+  // Empty ring, look for the end of the socket. Returns 0 on hang-up.
+  return mSocket->readIpc(aData, aDataLen);
+}
+
+size_t
+WifiShmIpcHandler::getNextPacketSize()
+{
+  // The rings carry a byte stream.
+  return 0;
+}
+
+int
+WifiShmIpcHandler::writeIpc(uint8_t* aData, size_t aDataLen)
+{
+  struct iovec iov;
+  struct pollfd pfd;
+  int size;
+  bool drained = false;
+
+  if (!mIsConnected) {
+    return -1;
+  }
+
+  iov.iov_base = aData;
+  iov.iov_len = aDataLen;
+
+  while (iov.iov_len > 0) {
+    size = writeRing(&iov, 1);
+    if (size < 0) {
+      return -1;
+    }
+    iov.iov_base = static_cast<uint8_t*>(iov.iov_base) + size;
+    iov.iov_len -= size;
+
+    if (size == 0) {
+      pfd.fd = mEpollFd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      TEMP_FAILURE_RETRY(poll(&pfd, 1, -1));
+      // The socket keeps the epoll set readable once the peer is gone.
+      if (hasHungUp()) {
+        WIFID_ERROR("Peer hung up with a full ring.");
+        return -1;
+      }
+      drainEvent();
+      drained = true;
+    }
+  }
+
+  if (drained) {
+    // The wake-up may have been meant for the reader of this side.
+    wakeSelf();
+  }
+
+  return aDataLen;
+}
+
+int
+WifiShmIpcHandler::writevIpc(const struct iovec* aIov, int aIovCnt)
+{
+  if (!mIsConnected) {
+    return -1;
+  }
+
+  return writeRing(aIov, aIovCnt);
+}
+
+int
+WifiShmIpcHandler::writeFramesIpc(const struct iovec* aFrames, int aCount)
+{
+  // The ring is a byte stream, frames go back to back.
+  return writevIpc(aFrames, aCount);
+}
+
+int
+WifiShmIpcHandler::closeIpc()
+{
+  if (mRegion) {
+    munmap(mRegion, mRegionSize);
+    mRegion = NULL;
+    mRx = mTx = NULL;
+    mRxData = mTxData = NULL;
+  }
+
+  if (mEpollFd != -1) {
+    close(mEpollFd);
+    mEpollFd = -1;
+  }
+
+  for (int i = 0; i < NUM_FDS; i++) {
+    if (mFds[i] != -1) {
+      close(mFds[i]);
+      mFds[i] = -1;
+    }
+  }
+
+  if (mIsConnected) {
+    mSocket->closeIpc();
+    mIsConnected = false;
+  }
+
+  return 0;
+}
+
+int
+WifiShmIpcHandler::waitForData()
+{
+  struct pollfd pfd;
+
+  if (!mIsConnected) {
+    return -1;
+  }
+
+  pfd.fd = mEpollFd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  return TEMP_FAILURE_RETRY(poll(&pfd, 1, -1));
+}
+
+bool
+WifiShmIpcHandler::isConnected()
+{
+  return mIsConnected && mSocket->isConnected();
+}
+
+bool
+WifiShmIpcHandler::isListening()
+{
+  return false;
+}
+
+IpcHandler*
+WifiShmIpcHandler::acceptIpc()
+{
+  return NULL;
+}
+
+int
+WifiShmIpcHandler::getFd()
+{
+  return mEpollFd;
+}
+
+// The peer maps the rings writable too, so each index is read once and
+// checked before it is used. Returns -1 on a corrupted ring.
+int
+WifiShmIpcHandler::readRing(uint8_t* aData, size_t aDataLen)
+{
+  uint32_t head = mRx->head;
+  uint32_t tail = mRx->tail;
+  uint32_t mask = mRingSize - 1;
+  size_t size = head - tail;
+  size_t first;
+
+  if (size == 0) {
+    return 0;
+  }
+
+  if (size > mRingSize) {
+    WIFID_ERROR("Corrupted receive ring, head %u tail %u.", head, tail);
+    errno = EPROTO;
+    return -1;
+  }
+
+  // Read the data only after seeing the head that covers it.
+  __sync_synchronize();
+
+  if (size > aDataLen) {
+    size = aDataLen;
+  }
+
+  first = mRingSize - (tail & mask);
+  if (first > size) {
+    first = size;
+  }
+  memcpy(aData, mRxData + (tail & mask), first);
+  memcpy(aData + first, mRxData, size - first);
+
+  __sync_synchronize();
+  mRx->tail = tail + size;
+  __sync_synchronize();
+
+  if (mRx->writerWaiting) {
+    mRx->writerWaiting = 0;
+    wakePeer();
+  }
+
+  if (mRx->head != tail + size) {
+    // More than the caller could take. Nobody else will wake us for it.
+    wakeSelf();
+  }
+
+  return size;
+}
+
+int
+WifiShmIpcHandler::writeRing(const struct iovec* aIov, int aIovCnt)
+{
+  uint32_t head = mTx->head;
+  uint32_t tail = mTx->tail;
+  uint32_t mask = mRingSize - 1;
+  size_t space;
+  size_t size = 0;
+
+  if (head - tail > mRingSize) {
+    WIFID_ERROR("Corrupted send ring, head %u tail %u.", head, tail);
+    errno = EPROTO;
+    return -1;
+  }
+
+  space = mRingSize - (head - tail);
+
+  if (space == 0) {
+    // Full, have the reader wake us once it made room.
+    mTx->writerWaiting = 1;
+    __sync_synchronize();
+    tail = mTx->tail;
+    if (head - tail > mRingSize) {
+      WIFID_ERROR("Corrupted send ring, head %u tail %u.", head, tail);
+      errno = EPROTO;
+      return -1;
+    }
+    space = mRingSize - (head - tail);
+    if (space == 0) {
+      return 0;
+    }
+    mTx->writerWaiting = 0;
+  }
+
+  for (int i = 0; i < aIovCnt && space > 0; i++) {
+    const uint8_t* base = static_cast<const uint8_t*>(aIov[i].iov_base);
+    size_t len = aIov[i].iov_len < space ? aIov[i].iov_len : space;
+    size_t first = mRingSize - ((head + size) & mask);
+
+    if (first > len) {
+      first = len;
+    }
+    memcpy(mTxData + ((head + size) & mask), base, first);
+    memcpy(mTxData, base + first, len - first);
+
+    size += len;
+    space -= len;
+  }
+
+  // Publish the data before the head, then look for a sleeping reader.
+  __sync_synchronize();
+  mTx->head = head + size;
+  __sync_synchronize();
+
+  if (mTx->readerWaiting) {
+    mTx->readerWaiting = 0;
+    wakePeer();
+  }
+
+  return size;
+}
+
+bool
+WifiShmIpcHandler::hasHungUp()
+{
+  struct pollfd pfd;
+
+  pfd.fd = mSocket->getFd();
+  pfd.events = POLLRDHUP;
+  pfd.revents = 0;
+
+  return TEMP_FAILURE_RETRY(poll(&pfd, 1, 0)) > 0 &&
+         (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR));
+}
+
+void
+WifiShmIpcHandler::wakePeer()
+{
+  uint64_t one = 1;
+
+  TEMP_FAILURE_RETRY(write(mFds[mIsDaemon ? FD_CLIENT_EVENT : FD_DAEMON_EVENT],
+    &one, sizeof(one)));
+}
+
+void
+WifiShmIpcHandler::wakeSelf()
+{
+  uint64_t one = 1;
+
+  TEMP_FAILURE_RETRY(write(mFds[mIsDaemon ? FD_DAEMON_EVENT : FD_CLIENT_EVENT],
+    &one, sizeof(one)));
+}
+
+void
+WifiShmIpcHandler::drainEvent()
+{
+  uint64_t count;
+
+  TEMP_FAILURE_RETRY(read(mFds[mIsDaemon ? FD_DAEMON_EVENT : FD_CLIENT_EVENT],
+    &count, sizeof(count)));
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiShmIpcHandler_h
+#define WifiShmIpcHandler_h
+
+#include <stdint.h>
+
+#include "IpcHandler.h"
+#include "WifiGonkMessage.h"
+
+/**
+ * IpcHandler over a pair of single-producer single-consumer rings in a
+ * memfd shared with the peer, one ring per direction. Messages are copied
+ * into and out of the rings without any syscall; an eventfd is only
+ * written when the other side sleeps on an empty (or full) ring.
+ *
+ * The region and the eventfds are handed over on the socket the peer is
+ * already connected with, which stays open to notice hang-ups. See
+ * WIFI_MESSAGE_TYPE_SHM_TRANSPORT in WifiGonkMessage.h for the layout.
+ *
+ * getFd() returns an epoll descriptor watching the eventfd of this side
+ * and the socket, so the handler plugs into the reactor like a socket.
+ * Room freed in the outgoing ring is reported as readable too.
+ */
+class WifiShmIpcHandler
+  : public IpcHandler
+{
+public:
+  static const uint32_t RING_SIZE = 64 * 1024;   // power of two
+
+  // Order of the descriptors passed in the handshake.
+  static const int FD_MEMFD = 0;
+  static const int FD_CLIENT_EVENT = 1;
+  static const int FD_DAEMON_EVENT = 2;
+  static const int NUM_FDS = 3;
+
+  ~WifiShmIpcHandler();
+
+  // Sets up a new region on the daemon side. Returns NULL if shared
+  // memory is not supported. aSocket is not owned, see setOwnsSocket().
+  static WifiShmIpcHandler* create(IpcHandler* aSocket);
+
+  // Maps the region received in a handshake, on the client side. Takes
+  // the ownership of aFds.
+  static WifiShmIpcHandler* attach(IpcHandler* aSocket, const int* aFds,
+                                   uint32_t aRingSize);
+
+  // Sends the handshake response aFrame along with the descriptors,
+  // without blocking. Fails if the socket can not take it at once.
+  int sendHandshake(const uint8_t* aFrame, size_t aLength);
+
+  // Reads one message from the socket aFd, with the descriptors of a
+  // handshake if any, else aFds are set to -1.
+  static int recvHandshake(int aFd, uint8_t* aBuf, size_t aLength, int* aFds);
+
+  void setOwnsSocket(bool aOwnsSocket)
+  {
+    mOwnsSocket = aOwnsSocket;
+  }
+
+  int openIpc();
+  int readIpc(uint8_t* aData, size_t aDataLen);
+  size_t getNextPacketSize();
+  int writeIpc(uint8_t* aData, size_t aDataLen);
+  int writevIpc(const struct iovec* aIov, int aIovCnt);
+  int writeFramesIpc(const struct iovec* aFrames, int aCount);
+  int closeIpc();
+  int waitForData();
+
+  bool isConnected();
+  bool isListening();
+  IpcHandler* acceptIpc();
+  int getFd();
+
+private:
+  WifiShmIpcHandler(IpcHandler* aSocket, bool aIsDaemon);
+
+  int init(uint32_t aRingSize);
+  int readRing(uint8_t* aData, size_t aDataLen);
+  int writeRing(const struct iovec* aIov, int aIovCnt);
+  bool hasHungUp();
+  void wakePeer();
+  void wakeSelf();
+  void drainEvent();
+
+  IpcHandler* mSocket;
+  bool mOwnsSocket;
+  bool mIsDaemon;
+  bool mIsConnected;
+  int mFds[NUM_FDS];
+  int mEpollFd;
+
+  uint8_t* mRegion;
+  size_t mRegionSize;
+  uint32_t mRingSize;
+  struct WifiShmRing* mRx;
+  uint8_t* mRxData;
+  struct WifiShmRing* mTx;
+  uint8_t* mTxData;
+};
+
+#endif // WifiShmIpcHandler_h
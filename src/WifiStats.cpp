@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "WifiMessageSchema.h"
+#include "WifiRequestTable.h"
+#include "WifiStats.h"
+
+#define WIFI_MESSAGE_SCHEMA_NAME(type, req, resp, priority, handler) #type,
+
+static const char* sTypeNames[] = {
+  WIFI_MESSAGE_SCHEMA(WIFI_MESSAGE_SCHEMA_NAME)
+};
+
+#define NUM_TYPE_NAMES (sizeof(sTypeNames) / sizeof(sTypeNames[0]))
+
+WifiStats::WifiStats()
+  : mStartTime(getTime())
+  , mNotifications(0)
+  , mNotificationBytes(0)
+{
+  memset(mTypes, 0, sizeof(mTypes));
+}
+
+uint64_t
+WifiStats::getTime()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+WifiStats::onRequest(uint32_t aConnId, uint16_t aMsgType, size_t aLength)
+{
+  struct WifiMessageStats* type = getType(aMsgType);
+  struct WifiMessageStats& conn = mConnections[aConnId];
+
+  type->requests++;
+  type->bytesIn += aLength;
+  conn.requests++;
+  conn.bytesIn += aLength;
+}
+
+void
+WifiStats::onResponse(uint32_t aConnId, uint16_t aMsgType, bool aError,
+  size_t aLength, uint64_t aStartTime)
+{
+  struct WifiMessageStats* type = getType(aMsgType);
+  struct WifiMessageStats& conn = mConnections[aConnId];
+  size_t bucket = getBucket(getTime() - aStartTime);
+
+  type->responses++;
+  type->bytesOut += aLength;
+  type->latency[bucket]++;
+  conn.responses++;
+  conn.bytesOut += aLength;
+  conn.latency[bucket]++;
+
+  if (aError) {
+    type->errors++;
+    conn.errors++;
+  }
+}
+
+void
+WifiStats::onNotification(size_t aLength)
+{
+  mNotifications++;
+  mNotificationBytes += aLength;
+}
+
+void
+WifiStats::removeConnection(uint32_t aConnId)
+{
+  mConnections.erase(aConnId);
+}
+
+void
+WifiStats::report(std::string* aOut, WifiRequestTable* aRequests)
+{
+  uint32_t typeInFlight[NUM_TYPES];
+  std::map<uint32_t, uint32_t> connInFlight;
+  std::map<uint32_t, struct WifiMessageStats>::iterator it;
+  struct WifiRequest* req;
+  char line[128];
+
+  memset(typeInFlight, 0, sizeof(typeInFlight));
+
+  for (size_t i = 0; i < WifiRequestTable::MAX_REQUESTS; i++) {
+    req = aRequests->getAt(i);
+    if (req) {
+      typeInFlight[getType(req->msgType) - mTypes]++;
+      connInFlight[req->connId]++;
+    }
+  }
+
+  snprintf(line, sizeof(line), "uptime %" PRIu64 "s notifications %u bytes %" PRIu64 "\n",
+    (getTime() - mStartTime) / 1000000, mNotifications, mNotificationBytes);
+  aOut->append(line);
+
+  for (size_t i = 0; i < NUM_TYPES; i++) {
+    if (mTypes[i].requests == 0) {
+      continue;
+    }
+    snprintf(line, sizeof(line), "type %s",
+      i < NUM_TYPE_NAMES ? sTypeNames[i] : "OTHER");
+    reportLine(aOut, line, &mTypes[i], typeInFlight[i]);
+  }
+
+  for (it = mConnections.begin(); it != mConnections.end(); ++it) {
+    snprintf(line, sizeof(line), "conn %u", it->first);
+    reportLine(aOut, line, &it->second, connInFlight[it->first]);
+  }
+}
+
+size_t
+WifiStats::getBucket(uint64_t aLatency)
+{
+  size_t bucket;
+
+  if (aLatency == 0) {
+    return 0;
+  }
+
+  bucket = 64 - __builtin_clzll(aLatency);
+
+  return bucket < WIFI_STATS_NUM_BUCKETS ? bucket : WIFI_STATS_NUM_BUCKETS - 1;
+}
+
+uint64_t
+WifiStats::getPercentile(const struct WifiMessageStats* aStats,
+  uint32_t aPerMille)
+{
+  uint64_t total = 0;
+  uint64_t seen = 0;
+  uint64_t rank;
+
+  for (size_t i = 0; i < WIFI_STATS_NUM_BUCKETS; i++) {
+    total += aStats->latency[i];
+  }
+
+  if (total == 0) {
+    return 0;
+  }
+
+  rank = (total * aPerMille + 999) / 1000;
+
+  // The upper bound of the bucket holding the rank.
+  for (size_t i = 0; i < WIFI_STATS_NUM_BUCKETS; i++) {
+    seen += aStats->latency[i];
+    if (seen >= rank) {
+      return 1ULL << i;
+    }
+  }
+
+  return 1ULL << (WIFI_STATS_NUM_BUCKETS - 1);
+}
+
+void
+WifiStats::reportLine(std::string* aOut, const char* aName,
+  const struct WifiMessageStats* aStats, uint32_t aInFlight)
+{
+  char buf[512];
+  int len;
+
+  len = snprintf(buf, sizeof(buf),
+    "%s req %u resp %u err %u inflight %u in %" PRIu64 " out %" PRIu64
+    " p50 %" PRIu64 "us p99 %" PRIu64 "us p999 %" PRIu64 "us hist",
+    aName, aStats->requests, aStats->responses, aStats->errors, aInFlight,
+    aStats->bytesIn, aStats->bytesOut, getPercentile(aStats, 500),
+    getPercentile(aStats, 990), getPercentile(aStats, 999));
+
+  for (size_t i = 0; i < WIFI_STATS_NUM_BUCKETS && len < static_cast<int>(sizeof(buf)); i++) {
+    len += snprintf(buf + len, sizeof(buf) - len, "%c%u",
+      i ? ',' : ' ', aStats->latency[i]);
+  }
+
+  aOut->append(buf);
+  aOut->append("\n");
+}
+
+struct WifiMessageStats*
+WifiStats::getType(uint16_t aMsgType)
+{
+  return &mTypes[aMsgType < NUM_TYPES ? aMsgType : NUM_TYPES - 1];
+}
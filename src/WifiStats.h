@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiStats_h
+#define WifiStats_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+
+#include "WifiMessageSchema.h"
+
+class WifiRequestTable;
+
+// Bucket 0 counts latencies under 1us, bucket n those under 2^n us.
+#define WIFI_STATS_NUM_BUCKETS 24
+
+struct WifiMessageStats {
+  uint32_t requests;
+  uint32_t responses;
+  uint32_t errors;
+  uint64_t bytesIn;
+  uint64_t bytesOut;
+  uint32_t latency[WIFI_STATS_NUM_BUCKETS];
+};
+
+/**
+ * Request counters and latency histograms, per message type and per
+ * connection.
+ *
+ * Requests are received and answered on the thread running
+ * WifiIpcManager::loop() only, so the counters are plain integers owned
+ * by that thread: recording costs a few increments and no lock or atomic
+ * operation. The in-flight depth is not counted but read from the request
+ * table when a report is made.
+ */
+class WifiStats
+{
+public:
+  // One entry per request type, unknown types share the extra last one.
+  static const size_t NUM_TYPES = WIFI_MESSAGE_NUM_TYPES + 1;
+
+  WifiStats();
+
+  // Monotonic time in microseconds.
+  static uint64_t getTime();
+
+  void onRequest(uint32_t aConnId, uint16_t aMsgType, size_t aLength);
+  void onResponse(uint32_t aConnId, uint16_t aMsgType, bool aError,
+                  size_t aLength, uint64_t aStartTime);
+  void onNotification(size_t aLength);
+  void removeConnection(uint32_t aConnId);
+
+  // Appends a text report, one line per message type and connection.
+  void report(std::string* aOut, WifiRequestTable* aRequests);
+
+private:
+  static size_t getBucket(uint64_t aLatency);
+  static uint64_t getPercentile(const struct WifiMessageStats* aStats,
+                                uint32_t aPerMille);
+  static void reportLine(std::string* aOut, const char* aName,
+                         const struct WifiMessageStats* aStats,
+                         uint32_t aInFlight);
+
+  struct WifiMessageStats* getType(uint16_t aMsgType);
+
+  uint64_t mStartTime;
+  uint32_t mNotifications;
+  uint64_t mNotificationBytes;
+  struct WifiMessageStats mTypes[NUM_TYPES];
+  std::map<uint32_t, struct WifiMessageStats> mConnections;
+};
+
+#endif // WifiStats_h
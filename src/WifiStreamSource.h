@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiStreamSource_h
+#define WifiStreamSource_h
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Produces the data of a chunked message piece by piece, only when the
+ * connection is ready to send the next chunk.
+ */
+class WifiStreamSource {
+public:
+  // Copies up to aLen bytes of data into aBuf. Returns the number of
+  // bytes copied, or -1 if the data can not be produced anymore.
+  virtual ssize_t read(uint8_t* aBuf, size_t aLen) = 0;
+
+  // Whether all of the data has been read.
+  virtual bool isDone() = 0;
+
+  virtual ~WifiStreamSource() {}
+};
+
+#endif // WifiStreamSource_h
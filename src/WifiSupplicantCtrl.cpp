@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "WifiBufferPool.h"
+#include "WifiDebug.h"
+#include "WifiMessageHandler.h"
+#include "WifiStats.h"
+#include "WifiSupplicantCtrl.h"
+
+// Binds a unique local address in the abstract namespace, so the
+// supplicant can reply without leaving files behind.
+int
+WifiSupplicantCtrl::bindLocal(int aFd, const char* aPrefix)
+{
+  static int sCounter = 0;
+  struct sockaddr_un addr;
+  int len;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "%s_%d_%d",
+    aPrefix, getpid(), __sync_fetch_and_add(&sCounter, 1));
+
+  return bind(aFd, reinterpret_cast<struct sockaddr*>(&addr),
+    offsetof(struct sockaddr_un, sun_path) + 1 + len);
+}
+
+int
+WifiSupplicantCtrl::connectSocket(const char* aCtrlPath, const char* aPrefix)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(aCtrlPath) >= sizeof(addr.sun_path)) {
+    WIFID_ERROR("Control path %s is too long.", aCtrlPath);
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    WIFID_ERROR("Could not create control socket: %s", strerror(errno));
+    return -1;
+  }
+
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  if (bindLocal(fd, aPrefix) < 0) {
+    WIFID_ERROR("Could not bind control socket: %s", strerror(errno));
+    ::close(fd);
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, aCtrlPath);
+
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+    WIFID_ERROR("Could not connect to %s: %s", aCtrlPath, strerror(errno));
+    ::close(fd);
+    return -1;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  return fd;
+}
+
+WifiSupplicantCtrl::WifiSupplicantCtrl(WifiIpcManager* aIpcMgr,
+  WifiMessageHandler* aMsgHandler, const char* aCtrlPath)
+  : mIpcMgr(aIpcMgr)
+  , mMsgHandler(aMsgHandler)
+  , mCtrlPath(aCtrlPath)
+  , mFd(-1)
+  , mReply(NULL)
+  , mWritePending(false)
+{
+  assert(aIpcMgr);
+  assert(aMsgHandler);
+  assert(aCtrlPath);
+}
+
+WifiSupplicantCtrl::~WifiSupplicantCtrl()
+{
+  close();
+}
+
+int
+WifiSupplicantCtrl::open()
+{
+  if (isOpen()) {
+    return 0;
+  }
+
+  mReply = static_cast<uint8_t*>(malloc(MAX_REPLY_SIZE));
+  if (!mReply) {
+    WIFID_ERROR("Could not allocate the supplicant reply buffer.");
+    return -1;
+  }
+
+  if (openSocket() < 0) {
+    free(mReply);
+    mReply = NULL;
+    return -1;
+  }
+
+  WIFID_DEBUG("Connected to the supplicant at %s.", mCtrlPath);
+
+  return 0;
+}
+
+int
+WifiSupplicantCtrl::openSocket()
+{
+  mFd = connectSocket(mCtrlPath, "wifid_ctrl");
+  if (mFd < 0) {
+    return -1;
+  }
+
+  if (mIpcMgr->addPollFd(mFd, EPOLLIN, this) < 0) {
+    ::close(mFd);
+    mFd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+WifiSupplicantCtrl::closeSocket()
+{
+  mIpcMgr->cancelTimer(this);
+  mIpcMgr->removePollFd(mFd);
+  ::close(mFd);
+  mFd = -1;
+  mWritePending = false;
+}
+
+bool
+WifiSupplicantCtrl::isAvailable()
+{
+  return access(mCtrlPath, F_OK) == 0;
+}
+
+void
+WifiSupplicantCtrl::close()
+{
+  if (!isOpen()) {
+    return;
+  }
+
+  closeSocket();
+  failAll();
+
+  free(mReply);
+  mReply = NULL;
+}
+
+int
+WifiSupplicantCtrl::sendCommand(WifiRequestId aId, const char* aCmd, size_t aLen)
+{
+  Command cmd;
+  int ret;
+
+  if (!isOpen()) {
+    return -1;
+  }
+
+  if (mInFlight.size() < MAX_PIPELINE && mBacklog.empty()) {
+    ret = transmit(aId, aCmd, aLen);
+    if (ret <= 0) {
+      return ret;
+    }
+    // The supplicant's queue is full, keep the command for later.
+  }
+
+  if (mBacklog.size() >= MAX_BACKLOG) {
+    WIFID_WARNING("Supplicant backlog is full.");
+    return -1;
+  }
+
+  cmd.id = aId;
+  cmd.len = aLen;
+  cmd.buf = WifiBufferPool::Instance()->alloc(aLen);
+  if (!cmd.buf) {
+    return -1;
+  }
+  memcpy(cmd.buf, aCmd, aLen);
+  mBacklog.push_back(cmd);
+
+  setWritePending(true);
+
+  return 0;
+}
+
+int
+WifiSupplicantCtrl::transmit(WifiRequestId aId, const void* aCmd, size_t aLen)
+{
+  SentCommand sent;
+  ssize_t ret;
+
+  ret = TEMP_FAILURE_RETRY(send(mFd, aCmd, aLen, MSG_NOSIGNAL));
+  if (ret < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 1;
+    }
+    WIFID_ERROR("Could not send the supplicant command: %s", strerror(errno));
+    return -1;
+  }
+
+  sent.id = aId;
+  sent.deadline = WifiStats::getTime() + REPLY_TIMEOUT_US;
+  mInFlight.push_back(sent);
+  if (mInFlight.size() == 1) {
+    updateTimer();
+  }
+
+  return 0;
+}
+
+void
+WifiSupplicantCtrl::fillPipeline()
+{
+  int ret;
+
+  while (!mBacklog.empty() && mInFlight.size() < MAX_PIPELINE) {
+    Command cmd = mBacklog.front();
+
+    ret = transmit(cmd.id, cmd.buf, cmd.len);
+    if (ret > 0) {
+      // Retry once the supplicant drained its queue.
+      return;
+    }
+
+    mBacklog.pop_front();
+
+    if (ret < 0) {
+      mMsgHandler->processResponse(cmd.id, WIFI_MESSAGE_TYPE_COMMAND,
+        WIFI_STATUS_ERROR, NULL, 0);
+    }
+
+    WifiBufferPool::Instance()->release(cmd.buf);
+  }
+
+  if (mBacklog.empty()) {
+    setWritePending(false);
+  }
+}
+
+void
+WifiSupplicantCtrl::setWritePending(bool aPending)
+{
+  if (mWritePending == aPending || !isOpen()) {
+    return;
+  }
+
+  mWritePending = aPending;
+  mIpcMgr->modifyPollFd(mFd, aPending ? (EPOLLIN | EPOLLOUT) : EPOLLIN, this);
+}
+
+// Keeps the timer on the deadline of the oldest sent command.
+void
+WifiSupplicantCtrl::updateTimer()
+{
+  uint64_t now;
+
+  if (mInFlight.empty()) {
+    mIpcMgr->cancelTimer(this);
+    return;
+  }
+
+  now = WifiStats::getTime();
+  mIpcMgr->setTimer(this, mInFlight.front().deadline > now ?
+    mInFlight.front().deadline - now : 0);
+}
+
+void
+WifiSupplicantCtrl::onTimer()
+{
+  std::deque<SentCommand> lost;
+
+  if (mInFlight.empty()) {
+    return;
+  }
+
+  WIFID_WARNING("Supplicant reply timed out, reopen the control socket.");
+
+  // Late replies must not reach the new socket, so swap it before the
+  // failed requests let new commands in.
+  lost.swap(mInFlight);
+  closeSocket();
+
+  if (openSocket() < 0) {
+    failAll();
+    free(mReply);
+    mReply = NULL;
+  } else if (!mBacklog.empty()) {
+    setWritePending(true);
+  }
+
+  while (!lost.empty()) {
+    WifiRequestId id = lost.front().id;
+    lost.pop_front();
+    mMsgHandler->processResponse(id, WIFI_MESSAGE_TYPE_COMMAND,
+      WIFI_STATUS_ERROR, NULL, 0);
+  }
+}
+
+void
+WifiSupplicantCtrl::failAll()
+{
+  WifiRequestId id;
+
+  while (!mInFlight.empty()) {
+    id = mInFlight.front().id;
+    mInFlight.pop_front();
+    mMsgHandler->processResponse(id, WIFI_MESSAGE_TYPE_COMMAND,
+      WIFI_STATUS_ERROR, NULL, 0);
+  }
+
+  while (!mBacklog.empty()) {
+    Command cmd = mBacklog.front();
+    mBacklog.pop_front();
+    mMsgHandler->processResponse(cmd.id, WIFI_MESSAGE_TYPE_COMMAND,
+      WIFI_STATUS_ERROR, NULL, 0);
+    WifiBufferPool::Instance()->release(cmd.buf);
+  }
+}
+
+void
+WifiSupplicantCtrl::onPollEvent(uint32_t aEvents)
+{
+  ssize_t len;
+  WifiRequestId id;
+  WifiStatusCode status;
+
+  if (aEvents & (EPOLLERR | EPOLLHUP)) {
+    WIFID_ERROR("Supplicant control socket failed.");
+    close();
+    return;
+  }
+
+  while (isOpen()) {
+    // MSG_TRUNC returns the full length of a longer reply.
+    len = TEMP_FAILURE_RETRY(recv(mFd, mReply, MAX_REPLY_SIZE,
+      MSG_DONTWAIT | MSG_TRUNC));
+
+    if (len < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        WIFID_ERROR("Could not read the supplicant reply: %s", strerror(errno));
+        close();
+      }
+      break;
+    }
+
+    // Unsolicited events only go to attached monitors, skip strays.
+    if (len > 0 && mReply[0] == '<') {
+      continue;
+    }
+
+    if (mInFlight.empty()) {
+      WIFID_WARNING("Supplicant reply without a command.");
+      continue;
+    }
+
+    id = mInFlight.front().id;
+    mInFlight.pop_front();
+    updateTimer();
+
+    status = WIFI_STATUS_OK;
+    if (static_cast<size_t>(len) > MAX_REPLY_SIZE) {
+      WIFID_WARNING("Supplicant reply of %zd bytes was truncated.", len);
+      status = WIFI_STATUS_ERROR;
+      len = 0;
+    }
+
+    mMsgHandler->processResponse(id, WIFI_MESSAGE_TYPE_COMMAND,
+      status, status == WIFI_STATUS_OK ? mReply : NULL, len);
+  }
+
+  if (isOpen()) {
+    fillPipeline();
+  }
+}
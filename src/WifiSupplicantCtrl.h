@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiSupplicantCtrl_h
+#define WifiSupplicantCtrl_h
+
+#include <stdint.h>
+#include <deque>
+
+#include "WifiIpcManager.h"
+#include "WifiRequestTable.h"
+
+class WifiMessageHandler;
+
+/**
+ * Persistent connection to the wpa_supplicant control interface.
+ *
+ * The supplicant answers the commands of one control socket strictly in
+ * order, so up to MAX_PIPELINE commands are sent back to back and every
+ * reply is matched to the oldest outstanding request. Commands beyond the
+ * pipeline depth, or refused by a full socket, wait in a backlog. Replies are delivered through
+ * WifiMessageHandler::processResponse() on the loop thread.
+ *
+ * A reply that does not arrive within REPLY_TIMEOUT_US fails every sent
+ * command and the socket is reopened, since the replies after a lost one
+ * could no longer be matched.
+ */
+class WifiSupplicantCtrl
+  : public WifiPollListener
+  , public WifiTimerListener
+{
+public:
+  // Stays below the default datagram queue length of the supplicant.
+  static const size_t MAX_PIPELINE = 8;
+  static const size_t MAX_BACKLOG = 256;
+  static const size_t MAX_REPLY_SIZE = 8192;
+  static const uint64_t REPLY_TIMEOUT_US = 10 * 1000 * 1000;
+
+  WifiSupplicantCtrl(WifiIpcManager* aIpcMgr, WifiMessageHandler* aMsgHandler,
+                     const char* aCtrlPath);
+  ~WifiSupplicantCtrl();
+
+  int open();
+  void close();
+
+  bool isOpen()
+  {
+    return mFd != -1;
+  }
+
+  // Whether the supplicant created its control socket yet.
+  bool isAvailable();
+
+  // Queues aCmd for the supplicant, the reply completes request aId.
+  int sendCommand(WifiRequestId aId, const char* aCmd, size_t aLen);
+
+  // Reads the replies of outstanding commands.
+  void onPollEvent(uint32_t aEvents);
+  // Fails the sent commands once the oldest reply is overdue.
+  void onTimer();
+
+  // Returns a non-blocking datagram socket connected to the control
+  // socket at aCtrlPath, or -1.
+  static int connectSocket(const char* aCtrlPath, const char* aPrefix);
+
+private:
+  static int bindLocal(int aFd, const char* aPrefix);
+
+  struct Command {
+    WifiRequestId id;
+    uint8_t* buf;
+    size_t len;
+  };
+
+  struct SentCommand {
+    WifiRequestId id;
+    uint64_t deadline;
+  };
+
+  int openSocket();
+  void closeSocket();
+  int transmit(WifiRequestId aId, const void* aCmd, size_t aLen);
+  void fillPipeline();
+  void failAll();
+  void setWritePending(bool aPending);
+  void updateTimer();
+
+  WifiIpcManager* mIpcMgr;
+  WifiMessageHandler* mMsgHandler;
+  const char* mCtrlPath;
+  int mFd;
+  uint8_t* mReply;
+  bool mWritePending;
+
+  // Sent commands, oldest first.
+  std::deque<SentCommand> mInFlight;
+  // Commands waiting for room in the pipeline.
+  std::deque<Command> mBacklog;
+};
+
+#endif // WifiSupplicantCtrl_h
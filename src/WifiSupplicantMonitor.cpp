@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "WifiDebug.h"
+#include "WifiMessageHandler.h"
+#include "WifiSupplicantCtrl.h"
+#include "WifiSupplicantMonitor.h"
+#include "WifiWorkerPool.h"
+
+#define ATTACH_TIMEOUT_MS 2000
+
+/**
+ * Carries one batch of events from the monitor thread to the loop thread.
+ */
+class WifiEventBatchTask
+  : public WifiTask
+{
+public:
+  WifiEventBatchTask(WifiMessageHandler* aMsgHandler, uint8_t* aData, size_t aLength)
+    : mMsgHandler(aMsgHandler)
+    , mData(aData)
+    , mLength(aLength)
+  {
+  }
+
+  ~WifiEventBatchTask()
+  {
+    free(mData);
+  }
+
+  void run()
+  {
+  }
+
+  void complete()
+  {
+    mMsgHandler->processNotification(WIFI_NOTIFICATION_EVENT, mData, mLength);
+  }
+
+private:
+  WifiMessageHandler* mMsgHandler;
+  uint8_t* mData;
+  size_t mLength;
+};
+
+WifiSupplicantMonitor::WifiSupplicantMonitor(WifiWorkerPool* aWorkerPool,
+  WifiMessageHandler* aMsgHandler, const char* aCtrlPath)
+  : mWorkerPool(aWorkerPool)
+  , mMsgHandler(aMsgHandler)
+  , mCtrlPath(aCtrlPath)
+  , mFd(-1)
+  , mStopFd(-1)
+  , mRunning(false)
+  , mJoinable(false)
+  , mBufs(NULL)
+{
+  assert(aWorkerPool);
+  assert(aMsgHandler);
+  assert(aCtrlPath);
+}
+
+WifiSupplicantMonitor::~WifiSupplicantMonitor()
+{
+  stop();
+}
+
+int
+WifiSupplicantMonitor::start()
+{
+  if (mRunning) {
+    return 0;
+  }
+
+  // Reaps a monitor thread that ended on a socket error.
+  stop();
+
+  mFd = WifiSupplicantCtrl::connectSocket(mCtrlPath, "wifid_mon");
+  if (mFd < 0) {
+    return -1;
+  }
+
+  mStopFd = eventfd(0, EFD_CLOEXEC);
+  mBufs = static_cast<uint8_t*>(malloc(MAX_BATCH * MAX_EVENT_SIZE));
+
+  if (mStopFd < 0 || !mBufs) {
+    stop();
+    return -1;
+  }
+
+  mRunning = true;
+  if (pthread_create(&mThread, NULL, threadMain, this)) {
+    WIFID_ERROR("Could not create the monitor thread.");
+    mRunning = false;
+    stop();
+    return -1;
+  }
+  mJoinable = true;
+
+  return 0;
+}
+
+void
+WifiSupplicantMonitor::stop()
+{
+  uint64_t one = 1;
+
+  if (mJoinable) {
+    TEMP_FAILURE_RETRY(write(mStopFd, &one, sizeof(one)));
+    pthread_join(mThread, NULL);
+    mJoinable = false;
+  }
+  mRunning = false;
+
+  if (mFd != -1) {
+    send(mFd, "DETACH", 6, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(mFd);
+    mFd = -1;
+  }
+
+  if (mStopFd != -1) {
+    close(mStopFd);
+    mStopFd = -1;
+  }
+
+  free(mBufs);
+  mBufs = NULL;
+}
+
+void*
+WifiSupplicantMonitor::threadMain(void* aArg)
+{
+  static_cast<WifiSupplicantMonitor*>(aArg)->monitor();
+
+  return NULL;
+}
+
+int
+WifiSupplicantMonitor::attach()
+{
+  struct pollfd fds[1];
+  char reply[16];
+  ssize_t len;
+
+  if (TEMP_FAILURE_RETRY(send(mFd, "ATTACH", 6, MSG_NOSIGNAL)) < 0) {
+    return -1;
+  }
+
+  fds[0].fd = mFd;
+  fds[0].events = POLLIN;
+
+  // Events may already arrive before the reply, skip them.
+  while (TEMP_FAILURE_RETRY(poll(fds, 1, ATTACH_TIMEOUT_MS)) > 0) {
+    len = TEMP_FAILURE_RETRY(recv(mFd, reply, sizeof(reply), MSG_DONTWAIT));
+    if (len < 0) {
+      return -1;
+    }
+    if (len > 0 && reply[0] == '<') {
+      continue;
+    }
+    return (len >= 2 && !strncmp(reply, "OK", 2)) ? 0 : -1;
+  }
+
+  return -1;
+}
+
+void
+WifiSupplicantMonitor::monitor()
+{
+  struct mmsghdr msgs[MAX_BATCH];
+  struct iovec iovs[MAX_BATCH];
+  struct pollfd fds[2];
+  int count;
+
+  if (attach() < 0) {
+    WIFID_ERROR("Could not attach to the supplicant events.");
+    mRunning = false;
+    return;
+  }
+
+  for (int i = 0; i < MAX_BATCH; i++) {
+    iovs[i].iov_base = mBufs + i * MAX_EVENT_SIZE;
+    iovs[i].iov_len = MAX_EVENT_SIZE - 1;
+  }
+
+  fds[0].fd = mFd;
+  fds[0].events = POLLIN;
+  fds[1].fd = mStopFd;
+  fds[1].events = POLLIN;
+
+  while (1) {
+    if (TEMP_FAILURE_RETRY(poll(fds, 2, -1)) < 0) {
+      WIFID_ERROR("Could not poll the supplicant events: %s", strerror(errno));
+      break;
+    }
+
+    if (fds[1].revents) {
+      return;
+    }
+
+    if (fds[0].revents & (POLLERR | POLLHUP)) {
+      WIFID_ERROR("Supplicant event socket hung up.");
+      break;
+    }
+
+    // Drain what has piled up, one syscall per batch.
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < MAX_BATCH; i++) {
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    count = TEMP_FAILURE_RETRY(recvmmsg(mFd, msgs, MAX_BATCH, MSG_DONTWAIT, NULL));
+    if (count < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        continue;
+      }
+      WIFID_ERROR("Could not read supplicant events: %s", strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      mLens[i] = msgs[i].msg_len;
+
+      // A cut event could be misread, drop it.
+      if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        WIFID_WARNING("Dropped a supplicant event longer than %zu bytes.",
+          MAX_EVENT_SIZE - 1);
+        mLens[i] = 0;
+      }
+    }
+
+    dispatch(count);
+  }
+
+  // Events are lost from here on, the next connect starts a new monitor.
+  mRunning = false;
+}
+
+void
+WifiSupplicantMonitor::dispatch(int aCount)
+{
+  size_t total = 0;
+  size_t offset = 0;
+  uint8_t* batch;
+
+  // Empty entries are dropped events.
+  for (int i = 0; i < aCount; i++) {
+    if (mLens[i] > 0) {
+      total += mLens[i] + 1;
+    }
+  }
+
+  if (total == 0) {
+    return;
+  }
+
+  batch = static_cast<uint8_t*>(malloc(total));
+  if (!batch) {
+    return;
+  }
+
+  // Pack the events as consecutive NUL-terminated strings, without the
+  // "<level>" prefix of the control interface.
+  for (int i = 0; i < aCount; i++) {
+    const char* event = reinterpret_cast<const char*>(mBufs + i * MAX_EVENT_SIZE);
+    size_t len = mLens[i];
+
+    if (len == 0) {
+      continue;
+    }
+
+    if (event[0] == '<') {
+      const char* end = static_cast<const char*>(memchr(event, '>', len));
+      if (end) {
+        len -= end + 1 - event;
+        event = end + 1;
+      }
+    }
+
+    memcpy(batch + offset, event, len);
+    offset += len;
+    batch[offset++] = '\0';
+  }
+
+  mWorkerPool->post(new WifiEventBatchTask(mMsgHandler, batch, offset));
+}
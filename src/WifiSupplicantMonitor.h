@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiSupplicantMonitor_h
+#define WifiSupplicantMonitor_h
+
+#include <pthread.h>
+#include <stdint.h>
+
+class WifiMessageHandler;
+class WifiWorkerPool;
+
+/**
+ * Listens to the supplicant's unsolicited events on an attached control
+ * socket from a thread of its own. Events are read in bulk with recvmmsg()
+ * and every batch is handed to the loop thread as one notification.
+ *
+ * The thread ends when the socket hangs up or fails, isRunning() turns
+ * false and the next start() replaces it.
+ */
+class WifiSupplicantMonitor
+{
+public:
+  static const int MAX_BATCH = 16;
+  static const size_t MAX_EVENT_SIZE = 4096;
+
+  WifiSupplicantMonitor(WifiWorkerPool* aWorkerPool,
+                        WifiMessageHandler* aMsgHandler,
+                        const char* aCtrlPath);
+  ~WifiSupplicantMonitor();
+
+  int start();
+  void stop();
+
+  bool isRunning()
+  {
+    return mRunning;
+  }
+
+private:
+  static void* threadMain(void* aArg);
+
+  void monitor();
+  int attach();
+  void dispatch(int aCount);
+
+  WifiWorkerPool* mWorkerPool;
+  WifiMessageHandler* mMsgHandler;
+  const char* mCtrlPath;
+  int mFd;
+  int mStopFd;
+  pthread_t mThread;
+  // Cleared by the monitor thread when it ends on an error.
+  volatile bool mRunning;
+  bool mJoinable;
+
+  uint8_t* mBufs;
+  size_t mLens[MAX_BATCH];
+};
+
+#endif // WifiSupplicantMonitor_h
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "WifiDebug.h"
+#include "WifiWorkerPool.h"
+
+WifiWorkerPool::WifiWorkerPool()
+  : mIpcMgr(NULL)
+  , mEventFd(-1)
+  , mNumWorkers(0)
+  , mStopping(false)
+  , mPendingHead(NULL)
+  , mPendingTail(NULL)
+  , mCompleted(NULL)
+{
+  pthread_mutex_init(&mLock, NULL);
+  pthread_cond_init(&mCond, NULL);
+}
+
+WifiWorkerPool::~WifiWorkerPool()
+{
+  stop();
+
+  pthread_cond_destroy(&mCond);
+  pthread_mutex_destroy(&mLock);
+}
+
+int
+WifiWorkerPool::start(WifiIpcManager* aIpcMgr, int aNumWorkers)
+{
+  assert(aIpcMgr);
+
+  mIpcMgr = aIpcMgr;
+
+  mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (mEventFd < 0) {
+    WIFID_ERROR("Could not create eventfd: %s", strerror(errno));
+    return -1;
+  }
+
+  if (mIpcMgr->addPollFd(mEventFd, EPOLLIN, this) < 0) {
+    close(mEventFd);
+    mEventFd = -1;
+    return -1;
+  }
+
+  if (aNumWorkers > MAX_WORKERS) {
+    aNumWorkers = MAX_WORKERS;
+  }
+
+  for (mNumWorkers = 0; mNumWorkers < aNumWorkers; mNumWorkers++) {
+    if (pthread_create(&mThreads[mNumWorkers], NULL, workerMain, this)) {
+      WIFID_ERROR("Could not create worker %d.", mNumWorkers);
+      break;
+    }
+  }
+
+  return mNumWorkers > 0 ? 0 : -1;
+}
+
+void
+WifiWorkerPool::stop()
+{
+  pthread_mutex_lock(&mLock);
+  mStopping = true;
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mLock);
+
+  for (int i = 0; i < mNumWorkers; i++) {
+    pthread_join(mThreads[i], NULL);
+  }
+  mNumWorkers = 0;
+
+  if (mEventFd != -1) {
+    mIpcMgr->removePollFd(mEventFd);
+    close(mEventFd);
+    mEventFd = -1;
+  }
+}
+
+void
+WifiWorkerPool::submit(WifiTask* aTask)
+{
+  assert(aTask);
+
+  aTask->mNext = NULL;
+
+  pthread_mutex_lock(&mLock);
+  if (mPendingTail) {
+    mPendingTail->mNext = aTask;
+  } else {
+    mPendingHead = aTask;
+  }
+  mPendingTail = aTask;
+  pthread_cond_signal(&mCond);
+  pthread_mutex_unlock(&mLock);
+}
+
+void
+WifiWorkerPool::post(WifiTask* aTask)
+{
+  assert(aTask);
+
+  pushCompletion(aTask);
+}
+
+void*
+WifiWorkerPool::workerMain(void* aArg)
+{
+  static_cast<WifiWorkerPool*>(aArg)->work();
+
+  return NULL;
+}
+
+void
+WifiWorkerPool::work()
+{
+  WifiTask* task;
+
+  while (1) {
+    pthread_mutex_lock(&mLock);
+    while (!mPendingHead && !mStopping) {
+      pthread_cond_wait(&mCond, &mLock);
+    }
+
+    if (mStopping) {
+      pthread_mutex_unlock(&mLock);
+      return;
+    }
+
+    task = mPendingHead;
+    mPendingHead = task->mNext;
+    if (!mPendingHead) {
+      mPendingTail = NULL;
+    }
+    pthread_mutex_unlock(&mLock);
+
+    task->run();
+    pushCompletion(task);
+  }
+}
+
+void
+WifiWorkerPool::pushCompletion(WifiTask* aTask)
+{
+  WifiTask* head;
+  uint64_t one = 1;
+
+  do {
+    head = mCompleted;
+    aTask->mNext = head;
+  } while (!__sync_bool_compare_and_swap(&mCompleted, head, aTask));
+
+  // Only the first completion of a batch needs to wake the loop.
+  if (!head) {
+    TEMP_FAILURE_RETRY(write(mEventFd, &one, sizeof(one)));
+  }
+}
+
+void
+WifiWorkerPool::onPollEvent(uint32_t aEvents)
+{
+  WifiTask* list;
+  WifiTask* ordered = NULL;
+  WifiTask* next;
+  uint64_t count;
+
+  TEMP_FAILURE_RETRY(read(mEventFd, &count, sizeof(count)));
+
+  // Take the whole stack at once.
+  do {
+    list = mCompleted;
+  } while (!__sync_bool_compare_and_swap(&mCompleted, list, NULL));
+
+  // The stack is newest first, restore completion order.
+  while (list) {
+    next = list->mNext;
+    list->mNext = ordered;
+    ordered = list;
+    list = next;
+  }
+
+  while (ordered) {
+    next = ordered->mNext;
+    ordered->complete();
+    delete ordered;
+    ordered = next;
+  }
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiWorkerPool_h
+#define WifiWorkerPool_h
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "WifiIpcManager.h"
+
+/**
+ * A unit of blocking work. run() is called on a worker thread, then
+ * complete() on the thread running WifiIpcManager::loop(), after which the
+ * task is deleted.
+ */
+class WifiTask
+{
+public:
+  WifiTask()
+    : mNext(NULL)
+  {
+  }
+
+  virtual void run() = 0;
+
+  virtual void complete() = 0;
+
+  virtual ~WifiTask() {}
+
+private:
+  friend class WifiWorkerPool;
+
+  WifiTask* mNext;
+};
+
+/**
+ * Runs tasks on a few worker threads. Finished tasks are pushed onto a
+ * lock-free completion stack and an eventfd wakes the epoll loop, which
+ * completes them in the order they finished. With several workers that
+ * may differ from the order they were submitted in.
+ */
+class WifiWorkerPool
+  : public WifiPollListener
+{
+public:
+  static const int DEFAULT_WORKERS = 2;
+  static const int MAX_WORKERS = 8;
+
+  WifiWorkerPool();
+  ~WifiWorkerPool();
+
+  int start(WifiIpcManager* aIpcMgr, int aNumWorkers);
+  void stop();
+
+  // Called on the loop thread. The pool takes ownership of aTask.
+  void submit(WifiTask* aTask);
+
+  // Called on any thread to complete aTask without running it on a
+  // worker, e.g. from a thread of its own.
+  void post(WifiTask* aTask);
+
+  // Completes finished tasks.
+  void onPollEvent(uint32_t aEvents);
+
+private:
+  static void* workerMain(void* aArg);
+
+  void work();
+  void pushCompletion(WifiTask* aTask);
+
+  WifiIpcManager* mIpcMgr;
+  int mEventFd;
+
+  pthread_t mThreads[MAX_WORKERS];
+  int mNumWorkers;
+  bool mStopping;
+
+  // Pending tasks, protected by mLock.
+  pthread_mutex_t mLock;
+  pthread_cond_t mCond;
+  WifiTask* mPendingHead;
+  WifiTask* mPendingTail;
+
+  // Finished tasks, pushed by any thread without locking.
+  WifiTask* volatile mCompleted;
+};
+
+#endif // WifiWorkerPool_h
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
+#include <signal.h>
 #include <cutils/log.h>
 
 #include "wifid.h"
@@ -22,15 +24,39 @@
 #include "WifiMessageHandler.h"
 #include "WifiIpcHandler.h"
 #include "WifiIpcManager.h"
+#include "WifiLegacyHal.h"
+#include "WifiLogger.h"
+#include "WifiSupplicantCtrl.h"
+#include "WifiSupplicantMonitor.h"
+#include "WifiWorkerPool.h"
 
 #define LOG_TAG "wifid"
 
 const char* SOCKNAME = "wifid";
+const char* SUPP_CTRL_PATH = "/data/misc/wifi/sockets/wlan0";
+
+// Keep the driver loaded this long after WiFi is turned off
+const uint64_t DRIVER_UNLOAD_DELAY_US = 10000000;
+
+// Send the supplicant events of a burst together
+const uint64_t EVENT_WINDOW_US = 5000;
+const size_t EVENT_MAX_BATCH = 64;
 
 bool gWifiDebugFlag = true;
 
 int main() {
 
+  // Only the loop thread takes the statistics and reconnect signals,
+  // through signalfds
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR1);
+  sigaddset(&mask, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  // Log from a background thread from now on
+  WifiLogger::Instance()->start();
+
   // Create the wifi ipc handler
   WifiIpcHandler* ipcHandler = new WifiIpcHandler(WifiIpcHandler::CONNECT_MODE, SOCKNAME, true);
 
@@ -40,10 +66,29 @@ int main() {
   // Create the Ipc manager
   WifiIpcManager* ipcManager = WifiIpcManager::Instance();
 
+  // Create the HAL and the workers running its blocking calls
+  WifiLegacyHal* hal = new WifiLegacyHal();
+  WifiWorkerPool* workerPool = new WifiWorkerPool();
+
   // Initiate
   ipcManager->init(ipcHandler, msgHandler);
   msgHandler->setIpcManager(ipcManager);
 
+  msgHandler->watchStatsSignal(SIGUSR1);
+  ipcManager->watchReconnectSignal(SIGUSR2);
+
+  workerPool->start(ipcManager, WifiWorkerPool::DEFAULT_WORKERS);
+  msgHandler->setHal(hal, workerPool);
+  msgHandler->setDriverUnloadDelay(DRIVER_UNLOAD_DELAY_US);
+  msgHandler->setEventWindow(EVENT_WINDOW_US, EVENT_MAX_BATCH);
+
+  // Connected on CONNECT_TO_SUPPLICANT
+  msgHandler->setSupplicantCtrl(
+    new WifiSupplicantCtrl(ipcManager, msgHandler, SUPP_CTRL_PATH),
+    new WifiSupplicantMonitor(workerPool, msgHandler, SUPP_CTRL_PATH));
 
+  // Serve the peer, reconnecting whenever it goes away
+  ipcManager->loop();
 
+  return 0;
 }
\ No newline at end of file
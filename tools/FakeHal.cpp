@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include "FakeHal.h"
+
+FakeHal::FakeHal(int aDriverDelayUs, int aSupplicantDelayUs)
+  : mDriverDelayUs(aDriverDelayUs)
+  , mSupplicantDelayUs(aSupplicantDelayUs)
+{
+}
+
+FakeHal::~FakeHal()
+{
+}
+
+int
+FakeHal::loadDriver()
+{
+  usleep(mDriverDelayUs);
+  return 0;
+}
+
+int
+FakeHal::unloadDriver()
+{
+  usleep(mDriverDelayUs);
+  return 0;
+}
+
+int
+FakeHal::startSupplicant(bool aP2pSupported)
+{
+  usleep(mSupplicantDelayUs);
+  return 0;
+}
+
+int
+FakeHal::stopSupplicant(bool aP2pSupported)
+{
+  usleep(mSupplicantDelayUs);
+  return 0;
+}
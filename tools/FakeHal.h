@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FakeHal_h
+#define FakeHal_h
+
+#include "WifiHal.h"
+
+/**
+ * WifiHal without hardware, for running wifid on a plain Linux host. Each
+ * call sleeps for a fixed time to stand in for the real driver and
+ * supplicant operations.
+ */
+class FakeHal
+  : public WifiHal
+{
+public:
+  FakeHal(int aDriverDelayUs, int aSupplicantDelayUs);
+  ~FakeHal();
+
+  int loadDriver();
+  int unloadDriver();
+  int startSupplicant(bool aP2pSupported);
+  int stopSupplicant(bool aP2pSupported);
+
+private:
+  int mDriverDelayUs;
+  int mSupplicantDelayUs;
+};
+
+#endif // FakeHal_h
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "FakeSupplicant.h"
+
+#define MAX_MSG_SIZE 8192
+
+FakeSupplicant::FakeSupplicant(const char* aCtrlPath, int aNumBss,
+  int aReplyDelayUs)
+  : mCtrlPath(aCtrlPath)
+  , mNumBss(aNumBss)
+  , mReplyDelayUs(aReplyDelayUs)
+  , mFd(-1)
+  , mRunning(false)
+  , mCommandCount(0)
+{
+  pthread_mutex_init(&mLock, NULL);
+}
+
+FakeSupplicant::~FakeSupplicant()
+{
+  stop();
+  pthread_mutex_destroy(&mLock);
+}
+
+int
+FakeSupplicant::start()
+{
+  struct sockaddr_un addr;
+
+  if (strlen(mCtrlPath) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+
+  mFd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (mFd < 0) {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, mCtrlPath);
+  unlink(mCtrlPath);
+
+  if (bind(mFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+    fprintf(stderr, "fake supplicant: bind %s: %s\n", mCtrlPath, strerror(errno));
+    close(mFd);
+    mFd = -1;
+    return -1;
+  }
+
+  mRunning = true;
+  if (pthread_create(&mThread, NULL, threadMain, this)) {
+    mRunning = false;
+    close(mFd);
+    mFd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+FakeSupplicant::stop()
+{
+  if (!mRunning) {
+    return;
+  }
+
+  mRunning = false;
+  shutdown(mFd, SHUT_RDWR);
+  pthread_join(mThread, NULL);
+  close(mFd);
+  mFd = -1;
+  unlink(mCtrlPath);
+}
+
+void*
+FakeSupplicant::threadMain(void* aArg)
+{
+  static_cast<FakeSupplicant*>(aArg)->serve();
+
+  return NULL;
+}
+
+void
+FakeSupplicant::serve()
+{
+  char cmd[MAX_MSG_SIZE];
+  char reply[MAX_MSG_SIZE];
+  struct sockaddr_un from;
+  socklen_t fromLen;
+  ssize_t len;
+  size_t replyLen;
+
+  while (mRunning) {
+    fromLen = sizeof(from);
+    len = recvfrom(mFd, cmd, sizeof(cmd) - 1, 0,
+      reinterpret_cast<struct sockaddr*>(&from), &fromLen);
+
+    if (len <= 0) {
+      if (len < 0 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    cmd[len] = '\0';
+    __sync_fetch_and_add(&mCommandCount, 1);
+
+    replyLen = handleCommand(cmd, len, &from, fromLen, reply, sizeof(reply));
+
+    if (mReplyDelayUs > 0) {
+      usleep(mReplyDelayUs);
+    }
+
+    sendto(mFd, reply, replyLen, 0,
+      reinterpret_cast<struct sockaddr*>(&from), fromLen);
+  }
+}
+
+size_t
+FakeSupplicant::handleCommand(const char* aCmd, size_t aLen,
+  const struct sockaddr_un* aFrom, socklen_t aFromLen,
+  char* aReply, size_t aReplySize)
+{
+  size_t len = 0;
+
+  if (!strcmp(aCmd, "PING")) {
+    return snprintf(aReply, aReplySize, "PONG\n");
+  }
+
+  if (!strcmp(aCmd, "ATTACH")) {
+    pthread_mutex_lock(&mLock);
+    mMonitors.push_back(*aFrom);
+    mMonitorLens.push_back(aFromLen);
+    pthread_mutex_unlock(&mLock);
+    return snprintf(aReply, aReplySize, "OK\n");
+  }
+
+  if (!strcmp(aCmd, "STATUS")) {
+    return snprintf(aReply, aReplySize,
+      "bssid=02:00:00:00:00:00\nfreq=2412\nssid=fake\nid=0\nmode=station\n"
+      "key_mgmt=WPA2-PSK\nwpa_state=COMPLETED\nip_address=192.168.1.2\n");
+  }
+
+  if (!strcmp(aCmd, "SIGNAL_POLL")) {
+    return snprintf(aReply, aReplySize,
+      "RSSI=-52\nLINKSPEED=65\nNOISE=9999\nFREQUENCY=2412\n");
+  }
+
+  if (!strcmp(aCmd, "SCAN_RESULTS")) {
+    len = snprintf(aReply, aReplySize,
+      "bssid / frequency / signal level / flags / ssid\n");
+    for (int i = 0; i < mNumBss && len < aReplySize; i++) {
+      len += snprintf(aReply + len, aReplySize - len,
+        "02:00:00:00:%02x:%02x\t%d\t%d\t[WPA2-PSK-CCMP][ESS]\tfake-%d\n",
+        (i >> 8) & 0xff, i & 0xff, 2412 + (i % 13) * 5, -40 - (i % 50), i);
+    }
+    return len < aReplySize ? len : aReplySize - 1;
+  }
+
+  return snprintf(aReply, aReplySize, "OK\n");
+}
+
+void
+FakeSupplicant::sendEvent(const char* aEvent)
+{
+  char buf[MAX_MSG_SIZE];
+  int len;
+
+  len = snprintf(buf, sizeof(buf), "<2>%s", aEvent);
+
+  pthread_mutex_lock(&mLock);
+  for (size_t i = 0; i < mMonitors.size(); i++) {
+    sendto(mFd, buf, len, MSG_DONTWAIT,
+      reinterpret_cast<struct sockaddr*>(&mMonitors[i]), mMonitorLens[i]);
+  }
+  pthread_mutex_unlock(&mLock);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FakeSupplicant_h
+#define FakeSupplicant_h
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+
+/**
+ * Minimal stand-in for the wpa_supplicant control interface, for testing
+ * wifid on a plain Linux host. It answers commands on a datagram socket
+ * with canned replies and sends events to the attached monitors.
+ */
+class FakeSupplicant
+{
+public:
+  FakeSupplicant(const char* aCtrlPath, int aNumBss, int aReplyDelayUs);
+  ~FakeSupplicant();
+
+  int start();
+  void stop();
+
+  // Sends "<2>aEvent" to every attached monitor.
+  void sendEvent(const char* aEvent);
+
+  uint32_t getCommandCount()
+  {
+    return mCommandCount;
+  }
+
+private:
+  static void* threadMain(void* aArg);
+
+  void serve();
+  size_t handleCommand(const char* aCmd, size_t aLen,
+                       const struct sockaddr_un* aFrom, socklen_t aFromLen,
+                       char* aReply, size_t aReplySize);
+
+  const char* mCtrlPath;
+  int mNumBss;
+  int mReplyDelayUs;
+  int mFd;
+  pthread_t mThread;
+  bool mRunning;
+  volatile uint32_t mCommandCount;
+
+  pthread_mutex_t mLock;
+  std::vector<struct sockaddr_un> mMonitors;
+  std::vector<socklen_t> mMonitorLens;
+};
+
+#endif // FakeSupplicant_h
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "WifiBench.h"
+#include "WifiGonkMessage.h"
+#include "WifiIpcHandler.h"
+#include "WifiShmIpcHandler.h"
+#include "WifiStats.h"
+
+#define MAX_REQUEST_SIZE 1024
+
+WifiBench::WifiBench(const struct WifiBenchOptions* aOptions)
+  : mOptions(*aOptions)
+  , mListener(NULL)
+  , mIpc(NULL)
+  , mNextSessionId(0)
+  , mInFlight(0)
+  , mSent(0)
+  , mCompleted(0)
+  , mErrors(0)
+  , mElapsed(0)
+{
+  mSessions = new Session[MAX_SESSIONS];
+  memset(mSessions, 0, MAX_SESSIONS * sizeof(Session));
+}
+
+WifiBench::~WifiBench()
+{
+  if (mIpc) {
+    mIpc->closeIpc();
+    delete mIpc;
+  }
+
+  if (mListener) {
+    mListener->closeIpc();
+    delete mListener;
+  }
+
+  delete[] mSessions;
+}
+
+int
+WifiBench::open()
+{
+  struct pollfd fds[1];
+
+  if (!mOptions.listen) {
+    mIpc = new WifiIpcHandler(WifiIpcHandler::CONNECT_MODE, mOptions.sockName, true);
+    if (mIpc->openIpc() < 0) {
+      return -1;
+    }
+    return mOptions.shm ? upgradeToShm() : 0;
+  }
+
+  // Stand in for the peer a daemon in CONNECT_MODE talks to.
+  mListener = new WifiIpcHandler(WifiIpcHandler::LISTEN_MODE, mOptions.sockName, true);
+  if (mListener->openIpc() < 0) {
+    return -1;
+  }
+
+  fds[0].fd = mListener->getFd();
+  fds[0].events = POLLIN;
+
+  while (!mIpc) {
+    if (TEMP_FAILURE_RETRY(poll(fds, 1, -1)) < 0) {
+      return -1;
+    }
+    mIpc = mListener->acceptIpc();
+  }
+
+  return mOptions.shm ? upgradeToShm() : 0;
+}
+
+int
+WifiBench::upgradeToShm()
+{
+  uint8_t buf[WIFI_MESSAGE_MAX_FRAME_SIZE];
+  struct WifiMsgResp* resp = reinterpret_cast<struct WifiMsgResp*>(buf);
+  const struct WifiMsgShmTransport* body =
+    reinterpret_cast<const struct WifiMsgShmTransport*>(resp->data);
+  struct pollfd fds[1];
+  int shmFds[WifiShmIpcHandler::NUM_FDS];
+  WifiShmIpcHandler* shm;
+  uint16_t sessionId = mNextSessionId++;
+  int length;
+
+  if (send(sessionId, WIFI_MESSAGE_TYPE_SHM_TRANSPORT, NULL, 0) < 0) {
+    return -1;
+  }
+
+  fds[0].fd = mIpc->getFd();
+  fds[0].events = POLLIN;
+
+  // Whole packets, skipping the notifications sent before the response.
+  while (1) {
+    if (TEMP_FAILURE_RETRY(poll(fds, 1, -1)) < 0) {
+      return -1;
+    }
+
+    length = WifiShmIpcHandler::recvHandshake(mIpc->getFd(), buf, sizeof(buf), shmFds);
+    if (length < 0 && errno == EAGAIN) {
+      continue;
+    }
+    if (length <= 0) {
+      return -1;
+    }
+
+    if (static_cast<size_t>(length) >= sizeof(*resp) &&
+        resp->hdr.msgCategory == WIFI_MESSAGE_RESPONSE &&
+        resp->sessionId == sessionId) {
+      break;
+    }
+
+    for (int i = 0; i < WifiShmIpcHandler::NUM_FDS; i++) {
+      if (shmFds[i] >= 0) {
+        close(shmFds[i]);
+      }
+    }
+  }
+
+  if (resp->status != WIFI_STATUS_OK ||
+      static_cast<size_t>(length) < sizeof(*resp) + sizeof(*body)) {
+    fprintf(stderr, "No shared memory transport, staying on the socket.\n");
+    return 0;
+  }
+
+  shm = WifiShmIpcHandler::attach(mIpc, shmFds, body->ringSize);
+  if (!shm) {
+    return -1;
+  }
+  shm->setOwnsSocket(true);
+  mIpc = shm;
+
+  return 0;
+}
+
+int
+WifiBench::run()
+{
+  struct pollfd fds[1];
+  uint64_t start;
+  uint64_t end;
+  uint64_t now;
+  double nextDue;
+  double interval;
+  uint16_t msgType;
+  int timeout;
+  bool sending;
+
+  if (mOptions.versionPercent < 100 &&
+      request(WIFI_MESSAGE_TYPE_CONNECT_TO_SUPPLICANT, NULL, 0) != WIFI_STATUS_OK) {
+    fprintf(stderr, "Could not connect wifid to the supplicant.\n");
+    return -1;
+  }
+
+  fds[0].fd = mIpc->getFd();
+  fds[0].events = POLLIN;
+
+  start = WifiStats::getTime();
+  end = start + static_cast<uint64_t>(mOptions.duration) * 1000000;
+  nextDue = start;
+  interval = mOptions.rate ? 1000000.0 / mOptions.rate : 0;
+
+  while (1) {
+    now = WifiStats::getTime();
+    sending = now < end;
+
+    while (sending && mInFlight < mOptions.concurrency &&
+           (!mOptions.rate || nextDue <= now)) {
+      msgType = static_cast<int>(mSent % 100) < mOptions.versionPercent ?
+        WIFI_MESSAGE_TYPE_VERSION : WIFI_MESSAGE_TYPE_COMMAND;
+
+      while (mSessions[mNextSessionId].pending) {
+        mNextSessionId++;
+      }
+
+      if (send(mNextSessionId, msgType, mOptions.command,
+               msgType == WIFI_MESSAGE_TYPE_COMMAND ? strlen(mOptions.command) : 0) < 0) {
+        return -1;
+      }
+
+      Session& session = mSessions[mNextSessionId++];
+      session.startTime = mOptions.rate ? static_cast<uint64_t>(nextDue) : now;
+      session.msgType = msgType;
+      session.pending = true;
+      mInFlight++;
+      mSent++;
+      nextDue += interval;
+    }
+
+    if (!sending && (mInFlight == 0 || now > end + DRAIN_TIMEOUT_S * 1000000ULL)) {
+      break;
+    }
+
+    if (sending && mOptions.rate && mInFlight < mOptions.concurrency) {
+      timeout = nextDue > now ? (nextDue - now) / 1000 : 0;
+    } else {
+      timeout = 100;
+    }
+
+    if (TEMP_FAILURE_RETRY(poll(fds, 1, timeout)) < 0) {
+      return -1;
+    }
+
+    if (fds[0].revents && receive() < 0) {
+      fprintf(stderr, "Connection to wifid lost.\n");
+      return -1;
+    }
+  }
+
+  mElapsed = WifiStats::getTime() - start;
+
+  return 0;
+}
+
+int
+WifiBench::request(uint16_t aMsgType, const char* aBody, size_t aLen)
+{
+  struct pollfd fds[1];
+  uint16_t sessionId = mNextSessionId++;
+
+  fds[0].fd = mIpc->getFd();
+  fds[0].events = POLLIN;
+
+  if (send(sessionId, aMsgType, aBody, aLen) < 0) {
+    return -1;
+  }
+
+  mSessions[sessionId].msgType = aMsgType;
+  mSessions[sessionId].pending = true;
+  mInFlight++;
+
+  while (mSessions[sessionId].pending) {
+    if (TEMP_FAILURE_RETRY(poll(fds, 1, -1)) < 0 || receive() < 0) {
+      return -1;
+    }
+  }
+
+  return mSessions[sessionId].status;
+}
+
+int
+WifiBench::send(uint16_t aSessionId, uint16_t aMsgType, const char* aBody,
+  size_t aLen)
+{
+  uint8_t buf[MAX_REQUEST_SIZE];
+  struct WifiMsgReq* req = reinterpret_cast<struct WifiMsgReq*>(buf);
+  struct pollfd fds[1];
+  size_t offset = 0;
+  int size;
+
+  if (sizeof(*req) + aLen > sizeof(buf)) {
+    return -1;
+  }
+
+  req->hdr.msgCategory = WIFI_MESSAGE_REQUEST;
+  req->hdr.msgType = aMsgType;
+  req->hdr.len = sizeof(*req) - sizeof(req->hdr) + aLen;
+  req->sessionId = aSessionId;
+  memcpy(req->data, aBody, aLen);
+
+  // Only a socket returns early, wait for room in it.
+  while (offset < sizeof(*req) + aLen) {
+    size = mIpc->writeIpc(buf + offset, sizeof(*req) + aLen - offset);
+
+    if (size < 0 && errno == EAGAIN) {
+      fds[0].fd = mIpc->getFd();
+      fds[0].events = POLLOUT;
+      if (TEMP_FAILURE_RETRY(poll(fds, 1, -1)) < 0) {
+        return -1;
+      }
+      continue;
+    }
+    if (size < 0) {
+      return -1;
+    }
+
+    offset += size;
+  }
+
+  return 0;
+}
+
+int
+WifiBench::receive()
+{
+  uint8_t* buf;
+  uint8_t* msg;
+  size_t space;
+  size_t msgLen;
+  int length;
+  int status;
+
+  buf = mDecoder.getWriteBuffer(&space, mIpc->getNextPacketSize());
+  if (!buf) {
+    return -1;
+  }
+
+  length = mIpc->readIpc(buf, space);
+  if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return 0;
+  }
+  if (length <= 0) {
+    return -1;
+  }
+
+  mDecoder.commit(length);
+
+  while ((status = mDecoder.nextMessage(&msg, &msgLen)) > 0) {
+    complete(msg, msgLen);
+  }
+
+  return status;
+}
+
+void
+WifiBench::complete(uint8_t* aMsg, size_t aLen)
+{
+  struct WifiMsgResp* resp = reinterpret_cast<struct WifiMsgResp*>(aMsg);
+  Session* session;
+  uint32_t latency;
+
+  if (aLen < sizeof(*resp) || resp->hdr.msgCategory != WIFI_MESSAGE_RESPONSE ||
+      (resp->hdr.msgType & WIFI_MESSAGE_FLAG_MORE)) {
+    // Notifications, and all chunks of a response but the last.
+    return;
+  }
+
+  session = &mSessions[resp->sessionId];
+  if (!session->pending) {
+    return;
+  }
+
+  session->pending = false;
+  session->status = resp->status;
+  mInFlight--;
+
+  if (session->msgType != WIFI_MESSAGE_TYPE_VERSION &&
+      session->msgType != WIFI_MESSAGE_TYPE_COMMAND) {
+    return;
+  }
+
+  latency = WifiStats::getTime() - session->startTime;
+
+  mCompleted++;
+  if (resp->status != WIFI_STATUS_OK) {
+    mErrors++;
+  }
+
+  if (session->msgType == WIFI_MESSAGE_TYPE_VERSION) {
+    mVersionLatency.push_back(latency);
+  } else {
+    mCommandLatency.push_back(latency);
+  }
+}
+
+void
+WifiBench::report(FILE* aOut)
+{
+  double seconds = mElapsed / 1000000.0;
+
+  fprintf(aOut, "%u requests in %.2fs, %.0f req/s, %u errors, %u unanswered\n",
+    mCompleted, seconds, seconds > 0 ? mCompleted / seconds : 0, mErrors,
+    mSent - mCompleted);
+
+  reportLatency(aOut, "VERSION", &mVersionLatency);
+  reportLatency(aOut, "COMMAND", &mCommandLatency);
+}
+
+void
+WifiBench::reportLatency(FILE* aOut, const char* aName,
+  std::vector<uint32_t>* aSamples)
+{
+  size_t n = aSamples->size();
+
+  if (n == 0) {
+    return;
+  }
+
+  std::sort(aSamples->begin(), aSamples->end());
+
+  fprintf(aOut, "%-8s %8zu  p50 %6uus  p99 %6uus  p999 %6uus  max %6uus\n",
+    aName, n, (*aSamples)[(n - 1) * 500 / 1000], (*aSamples)[(n - 1) * 990 / 1000],
+    (*aSamples)[(n - 1) * 999 / 1000], (*aSamples)[n - 1]);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WifiBench_h
+#define WifiBench_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "IpcHandler.h"
+#include "WifiMessageDecoder.h"
+
+struct WifiBenchOptions {
+  const char* sockName;
+  bool listen;            // wait for the daemon to connect instead
+  bool shm;               // move to the shared memory transport
+  uint32_t rate;          // requests per second, 0 for as fast as possible
+  int concurrency;        // sessions in flight at most
+  int duration;           // seconds
+  int versionPercent;     // share of VERSION requests, the rest is COMMAND
+  const char* command;
+};
+
+/**
+ * Load generator for the wifid socket protocol. It opens the socket
+ * through WifiIpcHandler like the daemon's peers do, keeps up to
+ * `concurrency` sessions in flight and records the latency of every
+ * request.
+ *
+ * With a target rate the requests are scheduled ahead of time and the
+ * latency is measured from the scheduled time, so a stalled daemon shows
+ * up in the tail instead of slowing the generator down.
+ */
+class WifiBench
+{
+public:
+  static const int MAX_SESSIONS = 65536;
+  static const int DRAIN_TIMEOUT_S = 5;
+
+  WifiBench(const struct WifiBenchOptions* aOptions);
+  ~WifiBench();
+
+  int open();
+  int run();
+  void report(FILE* aOut);
+
+private:
+  struct Session {
+    uint64_t startTime;
+    uint16_t msgType;
+    uint16_t status;
+    bool pending;
+  };
+
+  // Sends one request and waits for its response, returns its status.
+  int request(uint16_t aMsgType, const char* aBody, size_t aLen);
+  int upgradeToShm();
+  int send(uint16_t aSessionId, uint16_t aMsgType, const char* aBody, size_t aLen);
+  int receive();
+  void complete(uint8_t* aMsg, size_t aLen);
+  void reportLatency(FILE* aOut, const char* aName, std::vector<uint32_t>* aSamples);
+
+  struct WifiBenchOptions mOptions;
+  IpcHandler* mListener;
+  IpcHandler* mIpc;
+  WifiMessageDecoder mDecoder;
+
+  Session* mSessions;
+  uint16_t mNextSessionId;
+  int mInFlight;
+
+  uint32_t mSent;
+  uint32_t mCompleted;
+  uint32_t mErrors;
+  uint64_t mElapsed;
+  std::vector<uint32_t> mVersionLatency;
+  std::vector<uint32_t> mCommandLatency;
+};
+
+#endif // WifiBench_h
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "FakeSupplicant.h"
+
+static void
+usage(const char* aName)
+{
+  fprintf(stderr, "Usage: %s [-b num_bss] [-d reply_delay_us] ctrl_path\n", aName);
+  exit(1);
+}
+
+int main(int argc, char* argv[]) {
+  int numBss = 20;
+  int delayUs = 0;
+  int opt;
+  sigset_t mask;
+  int sig;
+
+  while ((opt = getopt(argc, argv, "b:d:")) != -1) {
+    switch (opt) {
+      case 'b':
+        numBss = atoi(optarg);
+        break;
+      case 'd':
+        delayUs = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if (optind >= argc) {
+    usage(argv[0]);
+  }
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  FakeSupplicant supplicant(argv[optind], numBss, delayUs);
+
+  if (supplicant.start() < 0) {
+    return 1;
+  }
+
+  fprintf(stderr, "fake supplicant listening on %s\n", argv[optind]);
+
+  sigwait(&mask, &sig);
+
+  supplicant.stop();
+
+  fprintf(stderr, "served %u commands\n", supplicant.getCommandCount());
+
+  return 0;
+}
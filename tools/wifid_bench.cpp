@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "FakeHal.h"
+#include "FakeSupplicant.h"
+#include "WifiBench.h"
+#include "WifiIpcHandler.h"
+#include "WifiIpcManager.h"
+#include "WifiMessageHandler.h"
+#include "WifiSupplicantCtrl.h"
+#include "WifiSupplicantMonitor.h"
+#include "WifiWorkerPool.h"
+
+#define FAKE_NUM_BSS 20
+#define FAKE_DRIVER_DELAY_US 100000
+#define FAKE_SUPPLICANT_DELAY_US 50000
+
+bool gWifiDebugFlag = true;
+
+static void
+usage(const char* aName)
+{
+  fprintf(stderr,
+    "Usage: %s [-i] [-l] [-s] [-n sock_name] [-r rate] [-c concurrency]\n"
+    "          [-t seconds] [-v version_percent] [-C command] [-d reply_delay_us]\n"
+    "  -i  run wifid in this process, with a fake HAL and supplicant\n"
+    "  -l  listen for a wifid in CONNECT_MODE instead of connecting\n"
+    "  -s  move to the shared memory transport after connecting\n", aName);
+  exit(1);
+}
+
+static void*
+runLoop(void* aArg)
+{
+  static_cast<WifiIpcManager*>(aArg)->loop();
+
+  return NULL;
+}
+
+// Serves aSockName from this process, like wifid.cpp but listening, on a
+// fake HAL and a fake supplicant at aCtrlPath.
+static int
+startDaemon(const char* aSockName, const char* aCtrlPath)
+{
+  WifiIpcHandler* ipcHandler =
+    new WifiIpcHandler(WifiIpcHandler::LISTEN_MODE, aSockName, true);
+  WifiMessageHandler* msgHandler = new WifiMessageHandler();
+  WifiIpcManager* ipcManager = WifiIpcManager::Instance();
+  WifiWorkerPool* workerPool = new WifiWorkerPool();
+  pthread_t thread;
+
+  ipcManager->init(ipcHandler, msgHandler);
+  msgHandler->setIpcManager(ipcManager);
+
+  if (workerPool->start(ipcManager, WifiWorkerPool::DEFAULT_WORKERS) < 0) {
+    return -1;
+  }
+  msgHandler->setHal(new FakeHal(FAKE_DRIVER_DELAY_US, FAKE_SUPPLICANT_DELAY_US),
+    workerPool);
+
+  msgHandler->setSupplicantCtrl(
+    new WifiSupplicantCtrl(ipcManager, msgHandler, aCtrlPath),
+    new WifiSupplicantMonitor(workerPool, msgHandler, aCtrlPath));
+
+  return pthread_create(&thread, NULL, runLoop, ipcManager) ? -1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+  struct WifiBenchOptions options;
+  bool inProcess = false;
+  int replyDelayUs = 0;
+  char ctrlPath[64];
+  FakeSupplicant* supplicant = NULL;
+  int opt;
+  int ret;
+
+  options.sockName = "wifid";
+  options.listen = false;
+  options.shm = false;
+  options.rate = 0;
+  options.concurrency = 32;
+  options.duration = 5;
+  options.versionPercent = 50;
+  options.command = "PING";
+
+  while ((opt = getopt(argc, argv, "ilsn:r:c:t:v:C:d:")) != -1) {
+    switch (opt) {
+      case 'i':
+        inProcess = true;
+        break;
+      case 'l':
+        options.listen = true;
+        break;
+      case 's':
+        options.shm = true;
+        break;
+      case 'n':
+        options.sockName = optarg;
+        break;
+      case 'r':
+        options.rate = atoi(optarg);
+        break;
+      case 'c':
+        options.concurrency = atoi(optarg);
+        break;
+      case 't':
+        options.duration = atoi(optarg);
+        break;
+      case 'v':
+        options.versionPercent = atoi(optarg);
+        break;
+      case 'C':
+        options.command = optarg;
+        break;
+      case 'd':
+        replyDelayUs = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if (options.concurrency < 1 || options.concurrency >= WifiBench::MAX_SESSIONS ||
+      options.duration < 1 || (inProcess && options.listen)) {
+    usage(argv[0]);
+  }
+
+  if (inProcess) {
+    snprintf(ctrlPath, sizeof(ctrlPath), "/tmp/wifid_bench_%d", getpid());
+    supplicant = new FakeSupplicant(ctrlPath, FAKE_NUM_BSS, replyDelayUs);
+
+    if (supplicant->start() < 0 || startDaemon(options.sockName, ctrlPath) < 0) {
+      fprintf(stderr, "Could not start wifid in process.\n");
+      return 1;
+    }
+  }
+
+  WifiBench bench(&options);
+
+  if (bench.open() < 0) {
+    fprintf(stderr, "Could not open the %s socket.\n", options.sockName);
+    return 1;
+  }
+
+  ret = bench.run();
+  bench.report(stdout);
+
+  if (supplicant) {
+    supplicant->stop();
+    delete supplicant;
+  }
+
+  // The in-process daemon has no way to stop its loop.
+  fflush(stdout);
+  _exit(ret < 0 ? 1 : 0);
+}